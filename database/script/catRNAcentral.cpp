@@ -1,8 +1,14 @@
 const char* docstring=""
-"catRNAcentral input.fasta output.fasta output.tsv\n"
+"catRNAcentral [-mem=4096] input.fasta output.fasta output.tsv\n"
 "    Combine different RNAcentral entries from different specieis in\n"
 "    input.fasta for the same sequence into a single entry in output.fasta.\n"
 "    Also output the table for entry name vs species to output.tsv.\n"
+"\n"
+"Options:\n"
+"    -mem=4096   memory in MB for the species of entries. Beyond it, species\n"
+"                are sorted and written to temporary files output.tsv.N.tmp\n"
+"                (catRNAcentral.PID.N.tmp for stdout), which are merged\n"
+"                into output.tsv at the end\n"
 ;
 
 #include <iostream>
@@ -11,91 +17,367 @@ const char* docstring=""
 #include <cstring>
 #include <cstdlib>
 #include <fstream>
-#include <vector>
-#include <map>
+#include <sstream>
+#include <algorithm>
+#include <queue>
+#include <stdint.h>
+#include <unistd.h>
 
 using namespace std;
 
-void catRNAcentral(const string infile="-", 
-    const string outfasta="-",const string outtsv="-")
+inline uint64_t mix64(uint64_t x)
+{
+    x^=x>>33;
+    x*=0xff51afd7ed558ccdULL;
+    x^=x>>33;
+    x*=0xc4ceb9fe1a85ec53ULL;
+    x^=x>>33;
+    return x;
+}
+
+/* hash of name[0..len-1], eight bytes at a time */
+uint32_t hashName(const char *name, const size_t len)
+{
+    uint64_t hash=0x9e3779b97f4a7c15ULL^len, word;
+    size_t i;
+    for (i=0;i+8<=len;i+=8)
+    {
+        memcpy(&word,name+i,8);
+        hash=mix64(hash^word);
+    }
+    word=0;
+    memcpy(&word,name+i,len-i);
+    return mix64(hash^word)>>32;
+}
+
+/* entry names, interned in one arena, with an open addressing hash table
+ * from a name to its order of first appearance */
+class NameTable
+{
+public:
+    NameTable(): slot_list(1<<10,0), start_list(1,0) {}
+
+    size_t size() const {return start_list.size()-1;}
+
+    /* bytes allocated for the table */
+    size_t memory() const
+    {
+        return slot_list.capacity()*sizeof(uint64_t)+
+            start_list.capacity()*sizeof(size_t)+arena.capacity();
+    }
+
+    /* order of name, which is added if it is new */
+    size_t find(const char *name, const size_t len, bool &added)
+    {
+        uint32_t hash=hashName(name,len);
+        size_t mask=slot_list.size()-1;
+        size_t k,id;
+        for (k=hash&mask;slot_list[k];k=(k+1)&mask)
+        {
+            if ((slot_list[k]>>32)!=hash) continue;
+            id=(slot_list[k]&0xffffffffULL)-1;
+            if (start_list[id+1]-start_list[id]==len &&
+                memcmp(&arena[start_list[id]],name,len)==0)
+            {
+                added=false;
+                return id;
+            }
+        }
+        id=size();
+        arena.append(name,len);
+        start_list.push_back(arena.size());
+        slot_list[k]=((uint64_t)hash<<32)|(id+1);
+        added=true;
+        if (2*size()>slot_list.size()) grow();
+        return id;
+    }
+
+private:
+    vector<uint64_t> slot_list; // hash<<32 | order+1, or 0 if empty
+    vector<size_t> start_list;  // name of order id is arena[start_list[id]..
+    string arena;               //     start_list[id+1]-1]
+
+    void grow()
+    {
+        vector<uint64_t> old_list(2*slot_list.size(),0);
+        old_list.swap(slot_list);
+        size_t mask=slot_list.size()-1;
+        size_t j,k;
+        for (j=0;j<old_list.size();j++)
+        {
+            if (old_list[j]==0) continue;
+            for (k=(old_list[j]>>32)&mask;slot_list[k];k=(k+1)&mask);
+            slot_list[k]=old_list[j];
+        }
+    }
+};
+
+/* bytes of a buffer of capacity cap holding size bytes, after add more
+ * bytes are appended, counting the old buffer while it is copied */
+inline size_t grownBytes(const size_t size, const size_t cap,
+    const size_t add)
+{
+    if (size+add<=cap) return cap;
+    return cap+max(2*cap,size+add);
+}
+
+/* text of each line of the species table, which is the order of the entry
+ * and a piece of the line. Pieces are kept in input order in an arena
+ * until it is full, and then sorted by entry and written to a run file.
+ * Pieces of the same entry stay in input order in a run, and runs are
+ * merged in the order they are written. Pieces are written to a run
+ * before the arena, the piece list and the name table would together
+ * take more than max_mem bytes */
+class SpeciesRuns
+{
+public:
+    SpeciesRuns(const string &outtsv, const size_t max_mem,
+        const NameTable &name_table): outtsv(outtsv), max_mem(max_mem),
+        name_table(name_table), Nfile(0) {}
+
+    void add(const size_t id, const string &text)
+    {
+        size_t mem=name_table.memory()+
+            grownBytes(arena.size(),arena.capacity(),text.size()+1)+
+            grownBytes(piece_list.size(),piece_list.capacity(),1)*
+            sizeof(pair<size_t,size_t>);
+        if (piece_list.size() && mem>max_mem) spill();
+        piece_list.push_back(make_pair(id,arena.size()));
+        arena+=text;
+        arena+='\n';
+    }
+
+    /* write one line per entry */
+    void write()
+    {
+        ofstream fp_tsv;
+        if (outtsv!="-") fp_tsv.open(outtsv.c_str(),ofstream::out);
+        ostream &out=(outtsv=="-")?cout:fp_tsv;
+        if (run_list.size()==0)
+        {
+            sort(piece_list.begin(),piece_list.end());
+            size_t p,id,last=0;
+            for (p=0;p<piece_list.size();p++)
+            {
+                id=piece_list[p].first;
+                if (p && id!=last) out<<'\n';
+                last=id;
+                const char *text=&arena[piece_list[p].second];
+                out.write(text,strchr(text,'\n')-text);
+            }
+            if (p) out<<'\n';
+            fp_tsv.close();
+            return;
+        }
+
+        /* merge each group of 256 consecutive runs into one run, in passes
+         * until all runs can be merged at once */
+        spill();
+        size_t r,g;
+        while (run_list.size()>256)
+        {
+            vector<string> merged_list;
+            for (g=0;g<run_list.size();g+=256)
+            {
+                size_t Nrun=min((size_t)256,run_list.size()-g);
+                merged_list.push_back(runName());
+                ofstream fp_run(merged_list.back().c_str(),ofstream::out);
+                merge(g,Nrun,fp_run,false);
+                fp_run.close();
+                for (r=g;r<g+Nrun;r++) remove(run_list[r].c_str());
+            }
+            run_list.swap(merged_list);
+        }
+        merge(0,run_list.size(),out,true);
+        for (r=0;r<run_list.size();r++) remove(run_list[r].c_str());
+        fp_tsv.close();
+    }
+
+private:
+    string outtsv;
+    size_t max_mem;
+    const NameTable &name_table;
+    string arena;
+    vector<pair<size_t,size_t> > piece_list; // entry, start in arena
+    vector<string> run_list;
+    size_t Nfile;  // number of run files written
+
+    /* name of the next run file */
+    string runName()
+    {
+        stringstream ss;
+        if (outtsv=="-") ss<<"catRNAcentral."<<getpid();
+        else ss<<outtsv;
+        ss<<'.'<<Nfile++<<".tmp";
+        return ss.str();
+    }
+
+    /* write pieces to a run file as lines "entry\tpiece" */
+    void spill()
+    {
+        run_list.push_back(runName());
+        ofstream fp_run(run_list.back().c_str(),ofstream::out);
+        if (!fp_run.good())
+        {
+            cerr<<"ERROR! Cannot write "<<run_list.back()<<endl;
+            exit(1);
+        }
+        sort(piece_list.begin(),piece_list.end());
+        for (size_t p=0;p<piece_list.size();p++)
+        {
+            const char *text=&arena[piece_list[p].second];
+            fp_run<<piece_list[p].first<<'\t';
+            fp_run.write(text,strchr(text,'\n')-text+1);
+        }
+        fp_run.close();
+        vector<pair<size_t,size_t> >().swap(piece_list);
+        string().swap(arena);
+    }
+
+    /* merge Nrun runs from run_list[begin] by entry and then by run,
+     * either into one table line per entry or into another run */
+    void merge(const size_t begin, const size_t Nrun, ostream &out,
+        const bool join)
+    {
+        vector<ifstream *> fp_list(Nrun);
+        vector<string> text_list(Nrun);
+        priority_queue<pair<size_t,size_t>,vector<pair<size_t,size_t> >,
+            greater<pair<size_t,size_t> > > queue;
+        size_t r,id,last=0;
+        for (r=0;r<Nrun;r++)
+        {
+            fp_list[r]=new ifstream(run_list[begin+r].c_str(),ios::in);
+            if (readPiece(*fp_list[r],id,text_list[r]))
+                queue.push(make_pair(id,r));
+        }
+        bool first=true;
+        while (queue.size())
+        {
+            id=queue.top().first;
+            r =queue.top().second;
+            queue.pop();
+            if (!join) out<<id<<'\t'<<text_list[r]<<'\n';
+            else
+            {
+                if (!first && id!=last) out<<'\n';
+                out<<text_list[r];
+            }
+            first=false;
+            last=id;
+            if (readPiece(*fp_list[r],id,text_list[r]))
+                queue.push(make_pair(id,r));
+        }
+        if (join && !first) out<<'\n';
+        for (r=0;r<Nrun;r++)
+        {
+            fp_list[r]->close();
+            delete fp_list[r];
+        }
+    }
+
+    bool readPiece(ifstream &fp_run, size_t &id, string &text)
+    {
+        if (!getline(fp_run,text)) return false;
+        size_t tab=text.find('\t');
+        id=strtoull(text.c_str(),NULL,10);
+        text.erase(0,tab+1);
+        return true;
+    }
+};
+
+void catRNAcentral(const string infile="-",
+    const string outfasta="-",const string outtsv="-",
+    const size_t max_mem=(size_t)4096<<20)
 {
+    ios::sync_with_stdio(false);
     ifstream fp_in;
     ofstream fp_fasta;
     if (infile!="-")   fp_in.open(infile.c_str(),ios::in);
     if (outfasta!="-") fp_fasta.open(outfasta.c_str(),ofstream::out);
-    string name,line;
+    istream &in=(infile=="-")?cin:fp_in;
+    ostream &out=(outfasta=="-")?cout:fp_fasta;
+    string line,text;
     size_t i;
-    bool readseq;
-    vector<string> name_vec;
-    map<string,string> species_map;
-    map<string,size_t> len_map;
+    bool readseq=false;
+    NameTable name_table;
+    SpeciesRuns species_runs(outtsv,max_mem,name_table);
 
-    /* write fasta */
-    while ((infile!="-")?fp_in.good():cin.good())
+    /* the first entry of a name is written to fasta, and its table line
+     * starts with its name, length and species once its sequence is read.
+     * Species of later entries of the name are appended to the line */
+    bool added;
+    size_t id=0, L=0;
+    string first_txt;
+    while (getline(in,line))
     {
-        if (infile!="-") getline(fp_in,line);
-        else getline(cin,line);
-
         if (line.length()==0) continue;
         if (line[0]=='>')
         {
+            if (readseq)
+            {
+                stringstream ss;
+                ss<<L;
+                species_runs.add(id,first_txt+'\t'+ss.str()+'\t'+text);
+            }
             for (i=1;i<line.size();i++)
                 if (line[i]=='_') break;
-            name=line.substr(1,i-1);
-            if (species_map.count(name))
+            id=name_table.find(line.data()+1,i-1,added);
+            text=(i<line.size())?line.substr(i+1):"";
+            if (!added)
             {
                 readseq=false;
-                species_map[name]+=","+line.substr(i+1);
+                species_runs.add(id,","+text);
                 continue;
             }
             readseq=true;
-            species_map[name]=line.substr(i+1);
-            name_vec.push_back(name);
-            len_map[name]=0;
-            if (outfasta=="-") cout<<line.substr(0,i)<<endl;
-            else           fp_fasta<<line.substr(0,i)<<endl;
+            first_txt=line.substr(1,i-1);
+            L=0;
+            out.write(line.data(),i);
+            out<<'\n';
         }
         else if (readseq)
         {
-            if (outfasta=="-") cout<<line<<endl;
-            else           fp_fasta<<line<<endl;
-            len_map[name]+=line.size();
-            line.clear();
+            out<<line<<'\n';
+            L+=line.size();
         }
     }
+    if (readseq)
+    {
+        stringstream ss;
+        ss<<L;
+        species_runs.add(id,first_txt+'\t'+ss.str()+'\t'+text);
+    }
     fp_in.close();
+    out.flush();
     fp_fasta.close();
     line.clear();
-    
+
     /* write species tsv */
-    ofstream fp_tsv;
-    if (outtsv!="-") fp_tsv.open(outtsv.c_str(),ofstream::out);
-    size_t L;
-    for (i=0;i<name_vec.size();i++)
-    {
-        name=name_vec[i];
-        L=len_map[name];
-        if (outtsv=="-") cout<<name<<'\t'<<L<<'\t'<<species_map[name]<<endl;
-        else           fp_tsv<<name<<'\t'<<L<<'\t'<<species_map[name]<<endl;
-    }
-    fp_tsv.close();
-    name.clear();
-    vector<string>().swap(name_vec);
-    map<string,string>().swap(species_map);
+    species_runs.write();
     return;
 }
 
 int main(int argc, char **argv)
 {
     /* parse commad line argument */
-    if(argc<2)
+    size_t max_mem=(size_t)4096<<20;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if (arg.substr(0,5)=="-mem=")
+            max_mem=(size_t)atol(arg.substr(5).c_str())<<20;
+        else arg_list.push_back(arg);
+    }
+    if (arg_list.size()<1)
     {
         cerr<<docstring;
         return 0;
     }
-    string infile=argv[1];
-    string outfasta=(argc<=2)?"-":argv[2];
-    string outtsv  =(argc<=3)?"-":argv[3];
-    catRNAcentral(infile,outfasta,outtsv);
+    string infile=arg_list[0];
+    string outfasta=(arg_list.size()<=1)?"-":arg_list[1];
+    string outtsv  =(arg_list.size()<=2)?"-":arg_list[2];
+    catRNAcentral(infile,outfasta,outtsv,max_mem);
     return 0;
 }
@@ -11,7 +11,7 @@ if [ -s "rnacentral_species_specific_ids.fasta.gz" ];then
 fi
 
 echo "makeblastdb"
-$bindir/makeblastdb -in rnacentral.fasta -parse_seqids -hash_index -dbtype nucl
+$bindir/makeblastdb -in rnacentral.fasta -parse_seqids -hash_index -dbtype nucl -blastdb_version 4
 
 ##echo "index hmmerdb"
 ##$bindir/esl-sfetch --index rnacentral.fasta
@@ -529,7 +529,7 @@ foreach my $msa(qw(
 ))
 {
     #$Nf=&run_calNf("$tmpdir/$msa");
-    $Nf=`$bindir/fastNf $tmpdir/$msa`+0; # somehow, unfiltered Nf selects slightly better MSA
+    $Nf=`$bindir/fastNf $tmpdir/$msa -threads=$cpu`+0; # somehow, unfiltered Nf selects slightly better MSA
     $hitnum=`grep '^>' $tmpdir/$msa|wc -l`+0;
     if ($Nf>=$max_Nf)
     {
@@ -589,7 +589,7 @@ for (my $d=0;$d<scalar @db_list;$d++)
         $strand   ="" if ( grep( /^$db$/, @db2_list) );
         &System("$bindir/qcmsearch $strand --noali -A $tmpdir/cmsearch.b$d.a2m --cpu $cpu --incE 10.0 $tmpdir/blastn.cm $tmpdir/dball|grep 'no alignment saved'");
         &addQuery2a2m("$tmpdir/cmsearch.b$d.a2m","$tmpdir/cmsearch.b$d.unfilter.afa");
-        &System("$bindir/fasta2pfam $tmpdir/cmsearch.b$d.unfilter.afa |cat -n |sort -u -k3|sort -n|grep -ohP '\\S+\\s\\S+\$'| $bindir/pfam2fasta - > $tmpdir/cmsearch.b$d.uniq.afa");
+        &System("$bindir/fastaUniq $tmpdir/cmsearch.b$d.unfilter.afa $tmpdir/cmsearch.b$d.uniq.afa");
         $hitnum=`grep '^>' $tmpdir/cmsearch.b$d.uniq.afa|wc -l`+0;
         &System("cp $tmpdir/cmsearch.b$d.uniq.afa $tmpdir/cmsearch.b$d.afa");
         if ($hitnum>=$max_hhfilter_seqs)
@@ -623,29 +623,37 @@ if (-s "$prefix.contact.txt")
 }
 else
 {
-    open(FP,">$tmpdir/seq.dbn.dot");
-    print FP `cat $tmpdir/seq.fasta $tmpdir/RNAfold.dbn`;
-    close(FP);
-    $ENV{DATAPATH}="$rootdir/data";
-    &System("$bindir/dot2ct $tmpdir/seq.dbn.dot $tmpdir/seq.dbn.ct");
+    ## base pairs of the dot-bracket structure, as read by dot2ct.
+    ## (), [], {}, <> and Aa to Zz are pairs of nested brackets
     my @pair_list=();
     my $min_sep =4;      # |i-j|>=$min_sep
-    foreach my $line(`cat $tmpdir/seq.dbn.ct`)
-    {
-        if ($line=~/^\s*(\d+)\s+\w+\s+\d+\s+\d+\s+(\d+)/)
+    my $dbn     =`head -1 $tmpdir/RNAfold.dbn`;
+    $dbn=~s/^\s*(\S*).*$/$1/s;
+    my %stack   =();
+    my %pair_hash=();
+    for (my $j=1;$j<=length $dbn;$j++)
+    {
+        my $c=substr($dbn,$j-1,1);
+        if ($c=~/[(\[{<A-Z]/)
         {
-            my $i  ="$1";
-            my $j  ="$2";
-            next if ($j-$i<$min_sep);
-            push(@pair_list,("$i\t$j"));
+            push(@{$stack{$c}},$j);
+            next;
         }
+        $c=~tr/)\]}>a-z/(\[{<A-Z/;
+        next if (!exists $stack{$c} || scalar @{$stack{$c}}==0);
+        my $i=pop(@{$stack{$c}});
+        $pair_hash{$i}=$j if ($j-$i>=$min_sep);
+    }
+    foreach my $i(sort {$a<=>$b} keys %pair_hash)
+    {
+        push(@pair_list,("$i\t$pair_hash{$i}"));
     }
 
     my $txt="";
     foreach my $msa(("$prefix.a.afa.gz","$prefix.b.afa.gz"))
     {
         &gz2plain("$msa","$tmpdir/seq.afa");
-        $Nf=`$bindir/fastNf $tmpdir/seq.afa`+0;
+        $Nf=`$bindir/fastNf $tmpdir/seq.afa -threads=$cpu`+0;
         &System("$bindir/plmc -c $tmpdir/seq.afa.dca_plmc -a -ACGT -le 20 -lh 0.01 -m 50 $tmpdir/seq.afa");
         my $total_score=0;
         my $tp=0;
@@ -757,22 +765,9 @@ sub addQuery2a2m
     }
     else
     {
-        #&System("$bindir/a3m2msa $infile | grep -ohP '^\\S+' > $outfile.tmp");
-        &System("$bindir/a3m2msa $infile | grep -ohP '^\\S+' | $bindir/fastaNA - > $outfile.tmp");
-        my $template_seq=`head -2 $outfile.tmp|tail -1`;
-        chomp($template_seq);
-        my $Lt=length $template_seq;
-        if ($Lch != $Lt)
-        {
-            ## merge msa by clustalo ##
-            print "echo $Lch != $Lt. realign by clustalo\n";
-            &System("$bindir/clustalo --p1=$tmpdir/seq.fasta --p2=$outfile.tmp --is-profile --threads=$cpu | $bindir/RemoveNonQueryPosition - | $bindir/fixAlnX - N $outfile");
-        }
-        else
-        {
-            &System("cat $tmpdir/seq.fasta $outfile.tmp | $bindir/fastaOneLine - | $bindir/fixAlnX - N $outfile");
-        }
-        &System("rm $outfile.tmp");
+        ## if template length != $Lch, the query is aligned to the
+        ## profile of the hits and columns not in the query are removed
+        &System("$bindir/addQuery2a2m -realign $tmpdir/seq.fasta $infile $outfile");
     }
     return $hitnum;
 }
@@ -784,17 +779,26 @@ sub retrieveSeq
 {
     my ($tabfile, $db, $tag)=@_;
     
+    my @nsd_list=grep {-s $_} glob("$db.nsd $db.*.nsd");
+    if (scalar @nsd_list)
+    {
+        # version 4 database: read fragments directly from the volumes
+        &System("$bindir/trimBlastN -max=$max_aln_seqs -merge -uniq -blastdb $db $tabfile $Lch $tmpdir/$tag.db");
+        return;
+    }
     &System("cut -f1 $tabfile|sort|uniq > $tmpdir/$tag.list");
     &System("split -l $max_split_seqs $tmpdir/$tag.list $tmpdir/$tag.list.split.");
+    my @split_list;
     foreach my $suffix (`ls $tmpdir/|grep $tag.list.split.|sed 's/$tag.list.split.//g'`)
     {
         chomp($suffix);
         &System("$bindir/blastdbcmd -db $db -entry_batch $tmpdir/$tag.list.split.$suffix -out $tmpdir/$tag.db.$suffix");
-        &System("sort -k4g $tabfile | head -$max_aln_seqs | $bindir/trimBlastN $tmpdir/$tag.db.$suffix - $Lch $tmpdir/$tag.trim.split.$suffix");
-        &System("rm $tmpdir/$tag.db.$suffix $tmpdir/$tag.list.split.$suffix");
+        &System("rm $tmpdir/$tag.list.split.$suffix");
+        push(@split_list, "$tmpdir/$tag.db.$suffix");
     }
-    &System("cat $tmpdir/$tag.trim.split.* | $bindir/fasta2pfam - | sort -u -k2 | $bindir/pfam2fasta - > $tmpdir/$tag.db");
-    &System("rm  $tmpdir/$tag.trim.split.*");
+    my $split_list=join(',',@split_list);
+    &System("$bindir/trimBlastN -max=$max_aln_seqs -merge -uniq -threads=$cpu $split_list $tabfile $Lch $tmpdir/$tag.db");
+    &System("rm @split_list");
     return;
 }
 
@@ -804,15 +808,13 @@ sub rmredundant_rawseq
     my ($infile,$outfile)=@_;
     my $throw_away_sequences=int(0.4*$Lch);
     $throw_away_sequences=9 if ($throw_away_sequences<10);
-    my @c_list=(1.00, 0.99, 0.95, 0.90);
-    @c_list   =(1.00) if ($fast==0);
-    for (my $i=0;$i<scalar @c_list; $i++)
+    my $c_list="1.00,0.99,0.95,0.90";
+    $c_list   ="1.00" if ($fast==0);
+    &System("$bindir/clusterNA -threads=$cpu -l=$throw_away_sequences -max=$max_aln_seqs $tmpdir/seq.fasta $infile $outfile $c_list");
+    foreach my $c(split(/,/,$c_list))
     {
-        &System("$bindir/cd-hit-est-2d -T $cpu -i $tmpdir/seq.fasta -i2 $infile -c $c_list[$i] -o $tmpdir/cdhitest2d.db -l $throw_away_sequences -M 5000");
-        &System("$bindir/cd-hit-est -T $cpu -i $tmpdir/cdhitest2d.db -c $c_list[$i] -o $outfile -l $throw_away_sequences -M 5000");
-        last if (`grep '>' $outfile|wc -l`+0<$max_aln_seqs);
+        &System("rm $outfile.$c");
     }
-    &System("rm $tmpdir/cdhitest2d.db");
     return;
 }
 
@@ -823,7 +825,16 @@ sub run_hhfilter
 
     my $cov=50;
     my $id =99;
-    &System("$bindir/hhfilter -i $infile -id $id -cov $cov -o $outfile");
+    my @setting_list;
+    foreach my $i ((99,96,93,90))
+    {
+        foreach my $c ((50,60,70))
+        {
+            push(@setting_list, "$i,$c,$outfile.$i.$c");
+        }
+    }
+    &System("$bindir/MSAfilter $infile @setting_list -threads=$cpu");
+    &System("cp $outfile.$id.$cov $outfile");
     my $hitnum=`grep '^>' $outfile|wc -l`+0;
     if ($hitnum>$max_hhfilter_seqs)
     {
@@ -834,10 +845,9 @@ sub run_hhfilter
             my @cov_list=(60,70);
             for (my $i=0;$i<scalar @cov_list;$i++)
             {
-                &System("$bindir/hhfilter -i $infile -id $id -cov $cov_list[$i] -o $outfile.tmp");
-                $Nf=&run_calNf("$outfile.tmp");
+                $Nf=&run_calNf("$outfile.$id.$cov_list[$i]");
                 last if ($Nf<=$target_Nf);
-                &System("mv $outfile.tmp $outfile");
+                &System("cp $outfile.$id.$cov_list[$i] $outfile");
                 $cov=$cov_list[$i];
                 #$hitnum=`grep '>' $outfile|wc -l`+0;
                 #last if ($hitnum<=$max_hhfilter_seqs);
@@ -847,7 +857,7 @@ sub run_hhfilter
         {
             foreach $id ((96,93,90))
             {
-                &System("$bindir/hhfilter -i $infile -id $id -cov $cov -o $outfile");
+                &System("cp $outfile.$id.$cov $outfile");
                 $hitnum=`grep '>' $outfile|wc -l`+0;
                 last if ($hitnum<=$max_hhfilter_seqs);
             }
@@ -859,12 +869,13 @@ sub run_hhfilter
         foreach $cov ((40))
         {
             #&System("$bindir/hhfilter -i $infile -id $id -cov $cov -o $outfile");
-            &System("$bindir/fasta2pfam $infile |cat -n |sort -u -k3|sort -n|grep -ohP '\\S+\\s\\S+\$'| $bindir/pfam2fasta - > $outfile.tmp");
-            &System("$bindir/hhfilter -i $outfile.tmp -id 100 -cov $cov -o $outfile");
+            &System("$bindir/fastaUniq $infile $outfile.tmp");
+            &System("$bindir/MSAfilter $outfile.tmp 100,$cov,$outfile");
             $hitnum=`grep '>' $outfile|wc -l`+0;
             last if ($hitnum>=$max_hhfilter_seqs);
         }
     }
+    &System("rm -f $outfile.9[0-9].[5-7]0 $outfile.9[0-9].[5-7]0.60");
     return $outfile;
 }
 
@@ -875,7 +886,7 @@ sub run_calNf
     my $target_Nf_cov=60; # only include sequences with high cov for Nf count
     system("$bindir/hhfilter -i $infile -id 99 -cov $target_Nf_cov -o $infile.$target_Nf_cov 1>/dev/null");
     my $target_Nf_tmp=$target_Nf+1;
-    return `$bindir/fastNf $infile.$target_Nf_cov 0.8 0 $target_Nf_tmp`+0;
+    return `$bindir/fastNf $infile.$target_Nf_cov 0.8 0 $target_Nf_tmp -threads=$cpu`+0;
 }
 
 ### copy gzip compressed file to plain file ###
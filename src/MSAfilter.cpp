@@ -0,0 +1,165 @@
+const char* docstring=""
+"MSAfilter seq.afa 99,50 99,60,seq.60.afa 96,70\n"
+"    Remove redundant sequences from alignment seq.afa like\n"
+"    'hhfilter -i seq.afa -id $id -cov $cov -o $outfile' for every\n"
+"    setting id,cov[,outfile] listed after seq.afa, reading and comparing\n"
+"    the sequences only once. outfile defaults to seq.afa.$id.$cov, and\n"
+"    '-' writes to stdout.\n"
+"\n"
+"    As in hhfilter, the first (query) sequence is always kept. Other\n"
+"    sequences are visited in decreasing number of residues; a sequence\n"
+"    is dropped if it has residues in less than cov% of columns, or if\n"
+"    its identity to a kept sequence, over columns where both have\n"
+"    residues, is above id%. Kept sequences are written in input order,\n"
+"    each on one line after its header. Lower case letters (insertions)\n"
+"    are written but not compared. As in hhfilter, U, B and Z are read as\n"
+"    C, D and E, and other letters than the 20 amino acids count as gaps,\n"
+"    so that nucleotide (ACGTUN) alignments are filtered the same way.\n"
+"\n"
+"Options (may be given anywhere after seq.afa):\n"
+"    -simd=auto   compare residues packed into bit-planes (default), or\n"
+"                 one byte per residue (scalar)\n"
+"    -threads=1   number of threads for pairwise comparison\n"
+;
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "packedMSA.h"
+
+using namespace std;
+
+/* read alignment as header lines and sequences. Sequence lines are
+ * joined until the next header. */
+void readRecords(const string infile, vector<string> &header_list,
+    vector<string> &sequence_list)
+{
+    string line;
+    ifstream fp;
+    if (infile!="-") fp.open(infile.c_str(),ios::in);
+    while ((infile!="-")?fp.good():cin.good())
+    {
+        if (infile!="-") getline(fp,line);
+        else getline(cin,line);
+        if (line.size() && line[line.size()-1]=='\r')
+            line=line.substr(0,line.size()-1);
+        if (line.size()==0) continue;
+        if (line[0]=='>')
+        {
+            header_list.push_back(line);
+            sequence_list.push_back("");
+            continue;
+        }
+        if (sequence_list.size()==0)
+        {
+            header_list.push_back("");
+            sequence_list.push_back("");
+        }
+        sequence_list.back()+=line;
+    }
+    if (infile!="-") fp.close();
+}
+
+void MSAfilter(const string infile, const vector<double> &id_list,
+    const vector<double> &cov_list, const vector<string> &outfile_list,
+    const string simd="auto", const int threads=1)
+{
+    vector<string> header_list;
+    vector<string> sequence_list;
+    readRecords(infile,header_list,sequence_list);
+    size_t Nseq=sequence_list.size();
+    size_t n,c;
+
+    CodeMatrix codes;
+    codes.Nseq=codes.L=codes.stride=0;
+    codes.data=NULL;
+    size_t capacity=Nseq;
+    for (n=0;n<Nseq;n++) add_line(sequence_list[n].data(),
+        sequence_list[n].size(),codes,capacity,NULL,hh_code);
+    EncodedMSA emsa;
+    encodeMSA(codes,(simd=="scalar")?0:-1,emsa);
+
+    vector<vector<char> > keep_mat;
+    hhfilter(emsa,id_list,cov_list,threads,keep_mat);
+    DeleteAlignedArray(&emsa.data);
+
+    for (c=0;c<outfile_list.size();c++)
+    {
+        ofstream fp;
+        if (outfile_list[c]!="-")
+        {
+            fp.open(outfile_list[c].c_str(),ios::out);
+            if (!fp.is_open())
+            {
+                cerr<<"ERROR! Cannot write "<<outfile_list[c]<<endl;
+                exit(1);
+            }
+        }
+        ostream &out=(outfile_list[c]!="-")?fp:cout;
+        for (n=0;n<Nseq;n++)
+        {
+            if (!keep_mat[c][n]) continue;
+            if (header_list[n].size()) out<<header_list[n]<<'\n';
+            out<<sequence_list[n]<<'\n';
+        }
+        if (outfile_list[c]!="-") fp.close();
+        else cout.flush();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    /* parse commad line argument */
+    string simd="auto";
+    int threads=1;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if      (arg.substr(0,6)=="-simd=") simd=arg.substr(6);
+        else if (arg.substr(0,9)=="-threads=")
+            threads=atoi(arg.substr(9).c_str());
+        else if (arg.size()>1 && arg[0]=='-')
+        {
+            cerr<<"ERROR! Unknown option "<<arg<<endl;
+            return 1;
+        }
+        else arg_list.push_back(arg);
+    }
+    if (arg_list.size()<2)
+    {
+        cerr<<docstring;
+        return 0;
+    }
+    string infile=arg_list[0];
+
+    /* id,cov[,outfile] settings */
+    vector<double> id_list;
+    vector<double> cov_list;
+    vector<string> outfile_list;
+    for (size_t a=1;a<arg_list.size();a++)
+    {
+        vector<string> field_list;
+        stringstream ss(arg_list[a]);
+        string field;
+        while (getline(ss,field,',')) field_list.push_back(field);
+        if (field_list.size()<2 || field_list.size()>3)
+        {
+            cerr<<"ERROR! Setting "<<arg_list[a]
+                <<" is not in the format id,cov[,outfile]"<<endl;
+            return 1;
+        }
+        id_list.push_back(atof(field_list[0].c_str()));
+        cov_list.push_back(atof(field_list[1].c_str()));
+        if (field_list.size()==3) outfile_list.push_back(field_list[2]);
+        else if (infile=="-") outfile_list.push_back("-");
+        else outfile_list.push_back(infile+'.'+field_list[0]+'.'+
+            field_list[1]);
+    }
+    MSAfilter(infile,id_list,cov_list,outfile_list,simd,threads);
+    return 0;
+}
@@ -8,68 +8,41 @@ const char* docstring=""
 #include <string>
 #include <cstring>
 #include <cstdlib>
-#include <fstream>
+#include "seqIO.h"
 
 using namespace std;
 
 int RemoveNonQueryPosition(const string infile="-", const string outfile="-")
 {
-    ifstream fp_in;
-    ofstream fp_out;
-    if (infile!="-") fp_in.open(infile.c_str(),ios::in);
-    if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
-    string sequence,line;
+    FastaReader fp_in(infile);
+    BlockWriter fp_out(outfile);
+    TextSpan header,sequence;
     int nseqs=0;
 
-    int i;
-    vector <int> nongap_pos; // position not corresponding to gap in query
+    size_t i;
+    vector <size_t> nongap_pos; // position not corresponding to gap in query
     string no_query_gap_sequence;
-    while ((infile!="-")?fp_in.good():cin.good())
+    while (fp_in.next(header,sequence))
     {
-        if (infile!="-") getline(fp_in,line);
-        else getline(cin,line);
-
-        if (line.length()==0) continue;
-        if (line[0]=='>')
+        if (header.size)
         {
-            if (sequence.length()>0)
-            {
-                if (nongap_pos.size()==0)
-                    for (i=0;i<sequence.size();i++)
-                        if (sequence[i]!='-') 
-                            nongap_pos.push_back(i);
-
-                no_query_gap_sequence.clear();
-                for (i=0;i<nongap_pos.size();i++)
-                    no_query_gap_sequence+=sequence[nongap_pos[i]];
-
-                if (outfile!="-") fp_out<<no_query_gap_sequence<<endl;
-                else                cout<<no_query_gap_sequence<<endl;
-            }
-            sequence.clear();
             nseqs++;
-            if (outfile!="-") fp_out<<line<<endl;
-            else                cout<<line<<endl;
+            fp_out.write(header);
+            fp_out.put('\n');
         }
-        else
-            sequence+=line;
+        if (sequence.size==0) continue;
+        if (nongap_pos.size()==0)
+            for (i=0;i<sequence.size;i++)
+                if (sequence[i]!='-') 
+                    nongap_pos.push_back(i);
+
+        no_query_gap_sequence.clear();
+        for (i=0;i<nongap_pos.size() && nongap_pos[i]<sequence.size;i++)
+            no_query_gap_sequence+=sequence[nongap_pos[i]];
+        no_query_gap_sequence+='\n';
+        fp_out.write(no_query_gap_sequence);
     }
-    fp_in.close();
-
-    if (nongap_pos.size()==0)
-        for (i=0;i<sequence.size();i++)
-            if (sequence[i]!='-') 
-                nongap_pos.push_back(i);
-
-    no_query_gap_sequence.clear();
-    for (i=0;i<nongap_pos.size();i++)
-        no_query_gap_sequence+=sequence[nongap_pos[i]];
-
-    if (outfile!="-") fp_out<<no_query_gap_sequence<<endl;
-    else                cout<<no_query_gap_sequence<<endl;
-
     fp_out.close();
-    sequence.clear();
     nongap_pos.clear();
     no_query_gap_sequence.clear();
     return nseqs;
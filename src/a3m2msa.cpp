@@ -9,51 +9,38 @@ const char* docstring=""
 #include <string>
 #include <cstring>
 #include <cstdlib>
-#include <fstream>
+#include "seqIO.h"
 
 using namespace std;
 
 int a3m2msa(const string infile="-", const string outfile="-")
 {
-    ifstream fp_in;
-    ofstream fp_out;
-    if (infile!="-") fp_in.open(infile.c_str(),ios::in);
-    if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
-    string sequence,line;
+    FastaReader fp_in(infile);
+    BlockWriter fp_out(outfile);
+    TextSpan header,sequence;
+    string msa;
     int nseqs=0;
-    int i=0;
-    while ((infile!="-")?fp_in.good():cin.good())
+    size_t i;
+    while (fp_in.next(header,sequence))
     {
-        if (infile!="-") getline(fp_in,line);
-        else getline(cin,line);
-
-        if (line.length()==0) continue;
-        if (line[0]=='>')
+        if (header.size)
         {
-            if (sequence.length()>0)
-            {
-                if (outfile!="-") fp_out<<sequence<<endl;
-                else                cout<<sequence<<endl;
-            }
-            sequence.clear();
             nseqs++;
-            if (outfile!="-") fp_out<<line<<endl;
-            else                cout<<line<<endl;
+            fp_out.write(header);
+            fp_out.put('\n');
         }
-        else
+        msa.clear();
+        for (i=0;i<sequence.size;i++)
         {
-            for (i=0;i<line.size();i++)
-            {
-                if (line[i]=='.' || ('a'<=line[i] && line[i]<='z')) continue;
-                sequence+=line[i];
-            }
+            if (sequence[i]=='.' || ('a'<=sequence[i] && sequence[i]<='z'))
+                continue;
+            msa+=sequence[i];
         }
+        if (msa.size()==0) continue;
+        fp_out.write(msa);
+        fp_out.put('\n');
     }
-    fp_in.close();
-    if (outfile!="-") fp_out<<sequence<<endl;
-    else                cout<<sequence<<endl;
     fp_out.close();
-    sequence.clear();
     return nseqs;
 }
 
@@ -0,0 +1,463 @@
+const char* docstring=""
+"addQuery2a2m [-realign] seq.fasta input.a2m output.afa\n"
+"    add query seq.fasta to nhmmer or cmsearch alignment input.a2m,\n"
+"    in one pass, as\n"
+"        a3m2msa input.a2m | grep -ohP '^\\S+' | fastaNA - > input.afa\n"
+"        cat seq.fasta input.afa | fastaOneLine - | fixAlnX - N output.afa\n"
+"    If the first sequence of input.afa is not as long as the query, write\n"
+"    input.afa to output.afa and exit with status 2, so that the caller can\n"
+"    realign it to the query.\n"
+"\n"
+"Options:\n"
+"    -realign  instead of exit with status 2, align the query to the column\n"
+"              profile of input.afa and keep only the columns aligned to\n"
+"              query residues, in place of\n"
+"        clustalo --p1=seq.fasta --p2=input.afa --is-profile \\\n"
+"            | RemoveNonQueryPosition - | fixAlnX - N output.afa\n"
+"              input.a2m is read twice, so it cannot be stdin\n"
+;
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include "seqIO.h"
+
+using namespace std;
+
+/* nucleotide as converted by fastaNA */
+inline char cleanNA(char na)
+{
+    if ('a'<=na && na<='z') na-=32;
+    if      (na=='I') na='A';
+    else if (na=='U') na='T';
+    if ('A'<=na && na<='Z' && (na!='A' && na!='T'
+                           &&  na!='C' && na!='G')) na='N';
+    return na;
+}
+
+/* length of the first word of text, as matched by grep -ohP '^\S+' */
+inline size_t firstWord(const char *text, const size_t size)
+{
+    size_t i;
+    for (i=0;i<size;i++) if (isspace((unsigned char)text[i])) break;
+    return i;
+}
+
+/* residue counts per column, and the order in which residue types are
+ * first seen, which breaks ties as in fixAlnX */
+class ColumnCount
+{
+public:
+    size_t L;
+    vector<size_t> count_mat; // [column*256+residue]
+    vector<int> order_list;   // rank of each residue type, or -1
+    string aa_list;           // residue types by rank
+
+    ColumnCount(): L(0), order_list(256,-1) {}
+
+    void add(const string &sequence, const char replace)
+    {
+        if (L==0)
+        {
+            L=sequence.size();
+            count_mat.assign(L*256,0);
+        }
+        for (size_t j=0;j<L;j++)
+        {
+            unsigned char aa=sequence[j];
+            if (aa=='-' || aa=='.' || aa==(unsigned char)replace) continue;
+            if (order_list[aa]<0)
+            {
+                order_list[aa]=aa_list.size();
+                aa_list+=aa;
+            }
+            count_mat[j*256+aa]++;
+        }
+    }
+
+    /* most frequent residue type of each column */
+    void best(string &best_list) const
+    {
+        best_list.assign(L,aa_list.size()?aa_list[0]:'N');
+        for (size_t j=0;j<L;j++)
+        {
+            const size_t *count=&count_mat[j*256];
+            for (size_t a=1;a<aa_list.size();a++)
+                if (count[(unsigned char)aa_list[a]]>
+                    count[(unsigned char)best_list[j]])
+                    best_list[j]=aa_list[a];
+        }
+    }
+};
+
+/* replace residue type replace in the sequence lines of txt */
+void fixText(char *txt, const size_t size, const char replace,
+    const string &best_list)
+{
+    char *line=txt, *last=txt+size;
+    while (line<last)
+    {
+        char *end=(char *)memchr(line,'\n',last-line);
+        if (!end) end=last;
+        if (line[0]!='>')
+            for (size_t j=0;j<(size_t)(end-line) && j<best_list.size();j++)
+                if (line[j]==replace) line[j]=best_list[j];
+        line=end+1;
+    }
+}
+
+/* output that is fixed in place once all columns are counted. A file is
+ * written through a BlockWriter and mapped again; stdout is kept in txt */
+class FixedOutput
+{
+public:
+    FixedOutput(const string &outfile): outfile(outfile), fp_out(NULL)
+    {
+        if (outfile!="-") fp_out=new BlockWriter(outfile);
+    }
+
+    void write(const char *data, const size_t size)
+    {
+        if (fp_out) fp_out->write(data,size);
+        else txt.append(data,size);
+    }
+
+    /* write a fasta record of one line each */
+    void record(const TextSpan &header, const string &sequence)
+    {
+        write(header.data,header.size);
+        write("\n",1);
+        write(sequence.data(),sequence.size());
+        write("\n",1);
+    }
+
+    void close(const char replace, const string &best_list)
+    {
+        if (!fp_out)
+        {
+            if (best_list.size())
+                fixText(&txt[0],txt.size(),replace,best_list);
+            BlockWriter fp_stdout("-");
+            fp_stdout.write(txt);
+            return;
+        }
+        fp_out->close();
+        delete fp_out;
+        fp_out=NULL;
+        if (best_list.size()==0) return;
+        int fd=open(outfile.c_str(),O_RDWR);
+        struct stat st;
+        if (fd<0 || fstat(fd,&st) || st.st_size==0) return;
+        char *buf=(char *)mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,
+            MAP_SHARED,fd,0);
+        ::close(fd);
+        if (buf==MAP_FAILED)
+        {
+            cerr<<"ERROR! Cannot map "<<outfile<<endl;
+            exit(1);
+        }
+        fixText(buf,st.st_size,replace,best_list);
+        munmap(buf,st.st_size);
+    }
+
+private:
+    string outfile;
+    BlockWriter *fp_out;
+    string txt;
+};
+
+/* hit as written to input.afa: insertions removed, header truncated at
+ * the first white space and nucleotides cleaned. Empty if the record has
+ * no alignment */
+void cleanRow(const TextSpan &sequence, string &row)
+{
+    row.clear();
+    size_t i;
+    for (i=0;i<sequence.size;i++)
+    {
+        char aa=sequence[i];
+        if (aa=='.' || ('a'<=aa && aa<='z')) continue;
+        row+=aa;
+    }
+    row.resize(firstWord(row.data(),row.size()));
+    for (i=0;i<row.size();i++) row[i]=cleanNA(row[i]);
+}
+
+/* index of nucleotide na in "ACGT", or 4 */
+inline int baseIndex(const char na)
+{
+    switch (na)
+    {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+    }
+    return 4;
+}
+
+/* align query to the columns of profile, which counts Nrow rows, with
+ * affine gaps, free end gaps and within a band of diagonals wide enough
+ * for any placement of the shorter one inside the longer one. A query
+ * residue scores the mean substitution score against the residues of a
+ * column, where gaps score 0, and skipping a column costs less the more
+ * rows have a gap there. col_list[i] is the column aligned to query
+ * residue i, or -1 */
+void alignProfile(const string &query, const ColumnCount &profile,
+    const size_t Nrow, vector<int> &col_list)
+{
+    const int match=200, mismatch=-100; // substitution score *100
+    const int gap_open=500, gap_ext=100;
+    const int NEG=-(1<<29);
+    const int Lq=query.size();
+    const int Lt=profile.L;
+    int i,c,k,a;
+
+    /* score of each base against each column, and the cost to skip it */
+    vector<int> prof_mat(Lt*5,0);
+    vector<int> skip_open(Lt), skip_ext(Lt);
+    for (c=0;c<Lt;c++)
+    {
+        const size_t *count=&profile.count_mat[c*256];
+        size_t nongap=0;
+        for (a=0;a<(int)profile.aa_list.size();a++)
+            nongap+=count[(unsigned char)profile.aa_list[a]];
+        double total=count['A']+count['C']+count['G']+count['T'];
+        for (a=0;a<4;a++)
+        {
+            double same=count[(unsigned char)"ACGT"[a]];
+            prof_mat[c*5+a]=(int)((match*same+mismatch*(total-same))/
+                (Nrow?Nrow:1));
+        }
+        double weight=Nrow?1.*nongap/Nrow:1;
+        skip_open[c]=(int)(gap_open*weight);
+        skip_ext[c] =(int)(gap_ext *weight);
+    }
+    vector<int> base_list(Lq);
+    for (i=0;i<Lq;i++) base_list[i]=baseIndex(query[i]);
+
+    /* diagonal c-i of cell k in any row is lo+k. The margin allows the
+     * path to drift by a tenth of the length from either end */
+    const int margin=32+max(Lq,Lt)/10;
+    const int lo=min(0,Lt-Lq)-margin;
+    const int W=abs(Lt-Lq)+2*margin+1;
+
+    /* traceback of each cell: bits 0-1 are the move into H (0 match,
+     * 1 skip column, 2 skip query residue, 3 start), bit 2 is set if E
+     * was opened from H, bit 3 is set if F was opened from H */
+    vector<unsigned char> tb_mat((size_t)(Lq+1)*W,3);
+    vector<int> prevH(W+1,NEG), prevF(W+1,NEG);
+    vector<int> curH(W+1,NEG), curF(W+1,NEG);
+    int best=NEG, best_i=0, best_c=0;
+    for (i=0;i<=Lq;i++)
+    {
+        int E=NEG;
+        for (k=0;k<W;k++)
+        {
+            c=i+lo+k;
+            curH[k]=curF[k]=NEG;
+            if (c<0 || c>Lt)
+            {
+                E=NEG;
+                continue;
+            }
+            unsigned char tb=0;
+            int H=NEG;
+            if (i==0 || c==0)
+            {
+                H=0;
+                tb=3;
+                E=NEG;
+            }
+            else
+            {
+                /* E: column c-1 is skipped */
+                int E_open=k?curH[k-1]-skip_open[c-1]:NEG;
+                int E_ext =E-skip_ext[c-1];
+                if (E_open>=E_ext) E=E_open, tb|=4;
+                else               E=E_ext;
+                /* F: query residue i-1 is skipped */
+                int F_open=prevH[k+1]-gap_open;
+                int F_ext =prevF[k+1]-gap_ext;
+                if (F_open>=F_ext) curF[k]=F_open, tb|=8;
+                else               curF[k]=F_ext;
+                if (curF[k]<NEG) curF[k]=NEG;
+                if (E<NEG) E=NEG;
+
+                H=prevH[k]+prof_mat[(c-1)*5+base_list[i-1]];
+                if (E>H)       H=E, tb|=1;
+                if (curF[k]>H) H=curF[k], tb=(tb&~3)|2;
+                if (H<NEG) H=NEG;
+            }
+            curH[k]=H;
+            tb_mat[(size_t)i*W+k]=tb;
+            if ((i==Lq || c==Lt) && H>best)
+            {
+                best=H;
+                best_i=i;
+                best_c=c;
+            }
+        }
+        prevH.swap(curH);
+        prevF.swap(curF);
+    }
+
+    col_list.assign(Lq,-1);
+    int state=0; // 0 H, 1 E, 2 F
+    i=best_i;
+    c=best_c;
+    while (i>0 && c>0)
+    {
+        unsigned char tb=tb_mat[(size_t)i*W+c-i-lo];
+        if (state==0)
+        {
+            state=tb&3;
+            if (state==3) break;
+            if (state==0)
+            {
+                col_list[i-1]=c-1;
+                i--;
+                c--;
+            }
+        }
+        else if (state==1)
+        {
+            if (tb&4) state=0;
+            c--;
+        }
+        else
+        {
+            if (tb&8) state=0;
+            i--;
+        }
+    }
+}
+
+/* return 2 if the alignment is not as long as the query and is not
+ * realigned, else 0 */
+int addQuery2a2m(const string queryfile, const string infile,
+    const string outfile, bool realign_query=false)
+{
+    const char replace='N';
+    TextSpan header,sequence;
+    string row;
+
+    /* query, of which the first sequence sets the length */
+    vector<string> query_header_list, query_list;
+    FastaReader fp_query(queryfile);
+    while (fp_query.next(header,sequence))
+    {
+        if (sequence.size==0) continue;
+        query_header_list.push_back(header.str());
+        query_list.push_back(sequence.str());
+    }
+    size_t Lch=query_list.size()?query_list[0].size():0;
+    if (infile=="-") realign_query=false;
+
+    /* hits. If they are realigned, only their profile is collected */
+    FixedOutput fp_out(outfile);
+    FastaReader fp_in(infile);
+    ColumnCount counts, profile;
+    size_t Nhit=0;
+    bool realign=false;
+    size_t i;
+    while (fp_in.next(header,sequence))
+    {
+        cleanRow(sequence,row);
+        if (row.size()==0) continue;
+        if (Nhit++==0)
+        {
+            if ((realign=(row.size()!=Lch)))
+                cerr<<Lch<<" != "<<row.size()<<". realign"<<endl;
+            else for (i=0;i<query_list.size();i++)
+            {
+                fp_out.record(TextSpan(query_header_list[i].data(),
+                    query_header_list[i].size()),query_list[i]);
+                counts.add(query_list[i],replace);
+            }
+        }
+        if (!realign)
+        {
+            if (row.size()!=Lch)
+            {
+                cerr<<"ERROR! length not match for sequence\n"
+                    <<query_list.size()+Nhit-1;
+                exit(0);
+            }
+            counts.add(row,replace);
+        }
+        else if (realign_query)
+        {
+            if (row.size()!=profile.L && profile.L)
+            {
+                cerr<<"ERROR! length not match for sequence\n"<<Nhit;
+                exit(0);
+            }
+            profile.add(row,'\0');
+            continue;
+        }
+        fp_out.record(TextSpan(header.data,firstWord(header.data,
+            header.size)),row);
+    }
+
+    /* read the hits again and keep the columns aligned to the query */
+    if (realign && realign_query)
+    {
+        vector<int> col_list;
+        alignProfile(query_list[0],profile,Nhit,col_list);
+        for (i=0;i<query_list.size();i++)
+        {
+            fp_out.record(TextSpan(query_header_list[i].data(),
+                query_header_list[i].size()),query_list[i]);
+            counts.add(query_list[i],replace);
+        }
+        string projected(Lch,'-');
+        FastaReader fp_hit(infile);
+        while (fp_hit.next(header,sequence))
+        {
+            cleanRow(sequence,row);
+            if (row.size()==0) continue;
+            for (i=0;i<Lch;i++)
+                projected[i]=(col_list[i]<0)?'-':row[col_list[i]];
+            counts.add(projected,replace);
+            fp_out.record(TextSpan(header.data,firstWord(header.data,
+                header.size)),projected);
+        }
+        realign=false;
+    }
+
+    /* without hits, the output is the query alone */
+    if (Nhit==0) for (i=0;i<query_list.size();i++)
+        fp_out.record(TextSpan(query_header_list[i].data(),
+            query_header_list[i].size()),query_list[i]);
+
+    string best_list;
+    if (Nhit && !realign) counts.best(best_list);
+    fp_out.close(replace,best_list);
+    return realign?2:0;
+}
+
+int main(int argc, char **argv)
+{
+    /* parse commad line argument */
+    bool realign_query=false;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if (arg=="-realign") realign_query=true;
+        else arg_list.push_back(arg);
+    }
+    if (arg_list.size()<3)
+    {
+        cerr<<docstring;
+        return 0;
+    }
+    string queryfile=arg_list[0];
+    string infile   =arg_list[1];
+    string outfile  =arg_list[2];
+    return addQuery2a2m(queryfile,infile,outfile,realign_query);
+}
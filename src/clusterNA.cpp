@@ -0,0 +1,689 @@
+const char* docstring=""
+"clusterNA seq.fasta trim.db db 1.00,0.99,0.95,0.90\n"
+"    Remove redundant nucleotide sequences from trim.db like\n"
+"        cd-hit-est-2d -i seq.fasta -i2 trim.db -c $c -o db.2d -l $l\n"
+"        cd-hit-est -i db.2d -c $c -o db.$c -l $l\n"
+"    for all identity cutoffs c in one pass, writing representatives of\n"
+"    trim.db to db.$c in input order. A sequence is dropped if it is not\n"
+"    longer than l, if it is at least c identical to a sequence in\n"
+"    seq.fasta that is not shorter, or if it is at least c identical to a\n"
+"    representative, which are chosen from the longest sequence down.\n"
+"    As in cd-hit, identity is the number of identical bases in a banded\n"
+"    alignment, on either strand, divided by the length of the shorter\n"
+"    sequence, and only pairs sharing enough short words are aligned.\n"
+"\n"
+"Options:\n"
+"    -l=L         throw away sequences with L or fewer bases. default is\n"
+"                 0.4 times the length of the first sequence in seq.fasta,\n"
+"                 or 9 if that is less than 10.\n"
+"    -max=N       also write db with the first cutoff that leaves fewer\n"
+"                 than N representatives (the last cutoff if none does)\n"
+"    -n=10        word length, from 4 to 12\n"
+"    -threads=1   number of threads\n"
+;
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include <unordered_set>
+
+using namespace std;
+
+struct NASeq
+{
+    string header;
+    string sequence; // as in input file
+    string norm;     // upper case, with U as T
+};
+
+/* read fasta file. sequence lines are joined until the next header */
+void readFasta(const string infile, vector<NASeq> &seq_list)
+{
+    string line;
+    ifstream fp;
+    if (infile!="-") fp.open(infile.c_str(),ios::in);
+    if (infile!="-" && !fp.is_open())
+    {
+        cerr<<"ERROR! Cannot read "<<infile<<endl;
+        exit(1);
+    }
+    while ((infile!="-")?fp.good():cin.good())
+    {
+        if (infile!="-") getline(fp,line);
+        else getline(cin,line);
+        if (line.size() && line[line.size()-1]=='\r')
+            line=line.substr(0,line.size()-1);
+        if (line.size()==0) continue;
+        if (line[0]=='>')
+        {
+            seq_list.push_back(NASeq());
+            seq_list.back().header=line;
+            continue;
+        }
+        if (seq_list.size()==0) seq_list.push_back(NASeq());
+        seq_list.back().sequence+=line;
+    }
+    if (infile!="-") fp.close();
+    for (size_t n=0;n<seq_list.size();n++)
+    {
+        string &norm=seq_list[n].norm;
+        norm=seq_list[n].sequence;
+        for (size_t i=0;i<norm.size();i++)
+        {
+            norm[i]=toupper(norm[i]);
+            if (norm[i]=='U') norm[i]='T';
+        }
+    }
+}
+
+void reverse_complement(const string &watson, string &crick)
+{
+    crick.resize(watson.size());
+    for (size_t i=0;i<watson.size();i++)
+    {
+        char C=watson[watson.size()-1-i];
+        switch (C)
+        {
+            case 'A': C='T'; break;
+            case 'C': C='G'; break;
+            case 'G': C='C'; break;
+            case 'T': C='A'; break;
+            case 'M': C='K'; break;
+            case 'K': C='M'; break;
+            case 'R': C='Y'; break;
+            case 'Y': C='R'; break;
+            case 'B': C='V'; break;
+            case 'D': C='H'; break;
+            case 'H': C='D'; break;
+            case 'V': C='B'; break;
+        }
+        crick[i]=C;
+    }
+}
+
+/* 2-bit code of A, C, G, T; -1 for other letters */
+struct NACode
+{
+    signed char code[256];
+    NACode()
+    {
+        for (int c=0;c<256;c++) code[c]=-1;
+        code['A']=0; code['C']=1; code['G']=2; code['T']=3;
+    }
+};
+static const NACode na_code;
+
+/* code of every word of length k starting at each position of seq.
+ * -1 for words with letters other than ACGT */
+void seq2words(const string &seq, const int k, vector<int> &word_list)
+{
+    word_list.resize(seq.size()>=(size_t)k?seq.size()-k+1:0);
+    int word=0;
+    int valid=0; // number of ACGT letters up to i
+    int mask=(1<<(2*k))-1;
+    for (size_t i=0;i<seq.size();i++)
+    {
+        int a=na_code.code[(unsigned char)seq[i]];
+        if (a<0) valid=0;
+        else
+        {
+            word=((word<<2)|a)&mask;
+            valid++;
+        }
+        if (i+1>=(size_t)k) word_list[i+1-k]=(valid>=k)?word:-1;
+    }
+}
+
+/* distinct words with their number of occurrences */
+void count_words(const vector<int> &word_list,
+    vector<pair<int,uint32_t> > &count_list)
+{
+    vector<int> sorted_list;
+    for (size_t i=0;i<word_list.size();i++)
+        if (word_list[i]>=0) sorted_list.push_back(word_list[i]);
+    sort(sorted_list.begin(),sorted_list.end());
+    count_list.clear();
+    for (size_t i=0;i<sorted_list.size();i++)
+    {
+        if (i && sorted_list[i]==sorted_list[i-1]) count_list.back().second++;
+        else count_list.push_back(make_pair(sorted_list[i],1));
+    }
+}
+
+/* occurrence of a word in a representative */
+struct WordHit
+{
+    uint32_t rep;
+    uint32_t count;
+};
+
+/* scratch space of one thread */
+struct Workspace
+{
+    vector<uint32_t> shared_list;  // shared words with each representative
+    vector<uint32_t> touched_list; // representatives with shared words
+    vector<int> head_list;         // first position of each word in query
+    vector<int> next_list;         // next position of the same word
+    vector<int> diag_list;         // shared words on each diagonal
+    vector<int> word_list;
+    vector<int> rep_word_list;
+    vector<pair<int,uint32_t> > count_list;
+    vector<int> H,E,M,EM;
+    string crick;
+    vector<uint32_t> profile_list[13]; // counts of q-words in query
+    vector<uint32_t> used_list[13];    // q-words matched in representative
+    vector<int> qword_list[13];
+};
+
+/* reset the q-word profiles of the query, which must be done before the
+ * next strand or query is compared */
+void clear_qwords(const int k, Workspace &ws)
+{
+    for (int q=4;q<k;q++)
+    {
+        for (size_t i=0;i<ws.qword_list[q].size();i++)
+            if (ws.qword_list[q][i]>=0)
+                ws.profile_list[q][ws.qword_list[q][i]]=0;
+        ws.qword_list[q].clear();
+    }
+}
+
+/* number of q-words of t, counted with multiplicity, that are also in
+ * the query whose q-word counts are in ws.profile_list[q] */
+int shared_qwords(const string &t, const int q, Workspace &ws)
+{
+    vector<uint32_t> &profile=ws.profile_list[q];
+    vector<uint32_t> &used=ws.used_list[q];
+    int shared=0;
+    int mask=(1<<(2*q))-1;
+    for (int pass=0;pass<2;pass++) // count, then reset used
+    {
+        int word=0, valid=0;
+        for (size_t i=0;i<t.size();i++)
+        {
+            int a=na_code.code[(unsigned char)t[i]];
+            if (a<0) {valid=0; continue;}
+            word=((word<<2)|a)&mask;
+            if (++valid<q) continue;
+            if (pass) used[word]=0;
+            else shared+=(used[word]++<profile[word]);
+        }
+    }
+    return shared;
+}
+
+/* number of identical bases in the best alignment of the whole of s to
+ * part of t (free end gaps in t), within band of diagonal j-i=diag.
+ * Scoring follows cd-hit-est: match 2, mismatch -2, gap -6, extension -1.
+ * Return -1 as soon as fewer than min_matches identical bases are
+ * possible: a path gains at most one identical base per row. */
+int align_matches(const string &s, const string &t, const int diag,
+    const int band, const int min_matches, Workspace &ws)
+{
+    const int match=2, mismatch=-2, gap_open=-6, gap_ext=-1;
+    const int NEG=-(1<<29);
+    int Ls=s.size();
+    int Lt=t.size();
+    int width=2*band+1;
+    int b,i,j;
+    /* score and identical bases of the best path to cell (i,j) of row i,
+     * and of the best path ending with a gap in t, for this and the
+     * previous row. Cell (i,j) is at b=j-i-diag+band. In the previous row,
+     * the same j is at b+1 and j-1 is at b. */
+    ws.H.resize(2*(width+1));
+    ws.E.resize(2*(width+1));
+    ws.M.resize(2*(width+1));
+    ws.EM.resize(2*(width+1));
+    int *H=&ws.H[0], *prevH=H+width+1;
+    int *E=&ws.E[0], *prevE=E+width+1;
+    int *M=&ws.M[0], *prevM=M+width+1;
+    int *EM=&ws.EM[0], *prevEM=EM+width+1;
+    /* row 0: leading part of t is free. Cell width stays out of band */
+    for (b=0;b<=width;b++)
+    {
+        j=diag-band+b;
+        H[b]=(b<width && j>=0 && j<=Lt)?0:NEG;
+        E[b]=prevH[b]=prevE[b]=NEG;
+        M[b]=EM[b]=prevM[b]=prevEM[b]=0;
+    }
+    for (i=1;i<=Ls;i++)
+    {
+        swap(H,prevH); swap(E,prevE); swap(M,prevM); swap(EM,prevEM);
+        int F=NEG, FM=0; // best path ending with a gap in s
+        int row_max=0;   // most identical bases of any path to this row
+        const char a=s[i-1];
+        for (b=0;b<width;b++)
+        {
+            j=i+diag-band+b;
+            if (j<0 || j>Lt)
+            {
+                H[b]=E[b]=F=NEG;
+                M[b]=EM[b]=0;
+                continue;
+            }
+            /* gap in t (s[i-1] unaligned): from (i-1,j) */
+            int open=prevH[b+1]+gap_open, ext=prevE[b+1]+gap_ext;
+            if (open>ext || (open==ext && prevM[b+1]>=prevEM[b+1]))
+                {E[b]=open; EM[b]=prevM[b+1];}
+            else {E[b]=ext; EM[b]=prevEM[b+1];}
+            int best=E[b], best_m=EM[b];
+            /* s[i-1] aligned to t[j-1]: from (i-1,j-1) */
+            if (j>=1)
+            {
+                bool same=(a==t[j-1]);
+                int score=prevH[b]+(same?match:mismatch);
+                int m=prevM[b]+same;
+                if (score>best || (score==best && m>best_m))
+                    {best=score; best_m=m;}
+            }
+            /* gap in s: from (i,j-1) */
+            if (b>0)
+            {
+                open=H[b-1]+gap_open;
+                ext=F+gap_ext;
+                if (open>ext || (open==ext && M[b-1]>=FM))
+                    {F=open; FM=M[b-1];}
+                else F=ext;
+                if (F>best || (F==best && FM>best_m)) {best=F; best_m=FM;}
+            }
+            if (best<NEG/2) best=NEG;
+            H[b]=best;
+            M[b]=best_m;
+            row_max=max(row_max,max(max(M[b],EM[b]),FM));
+        }
+        if (row_max+Ls-i<min_matches) return -1;
+    }
+    /* trailing part of t is free */
+    int best=NEG, best_m=0;
+    for (b=0;b<width;b++)
+        if (H[b]>best || (H[b]==best && M[b]>best_m))
+            {best=H[b]; best_m=M[b];}
+    return best_m;
+}
+
+/* most frequent offset j-i of words shared by position i of the query
+ * (indexed in ws.head_list, ws.next_list) and position j of t */
+int best_diagonal(const int Ls, const vector<int> &t_words, Workspace &ws)
+{
+    int Lt=t_words.size();
+    ws.diag_list.assign(Ls+Lt+1,0);
+    int best=0, best_count=-1;
+    for (int j=0;j<Lt;j++)
+    {
+        if (t_words[j]<0) continue;
+        int chain=0;
+        for (int i=ws.head_list[t_words[j]];i>=0 && chain<64;
+            i=ws.next_list[i],chain++)
+        {
+            int d=j-i+Ls;
+            if (++ws.diag_list[d]>best_count)
+            {
+                best_count=ws.diag_list[d];
+                best=j-i;
+            }
+        }
+    }
+    return best;
+}
+
+class NACluster
+{
+public:
+    vector<NASeq> seq_list; // queries first, then hits
+    size_t Nquery;
+    vector<double> cut_list;
+    int k;
+    int band;
+    int threads;
+
+    vector<vector<WordHit> > word_table;
+    vector<size_t>   rep_seq_list;  // sequence of each representative
+    vector<uint64_t> rep_mask_list; // cutoffs it represents
+    vector<vector<char> > keep_mat; // [cutoff][hit]
+
+    void cluster(const size_t min_len);
+    uint64_t cover_mask(const size_t n, const size_t rep_begin,
+        const size_t rep_end, uint64_t uncovered, Workspace &ws);
+    void add_rep(const size_t n, const uint64_t mask);
+};
+
+/* index words of sequence n as a representative of cutoffs in mask */
+void NACluster::add_rep(const size_t n, const uint64_t mask)
+{
+    uint32_t r=rep_seq_list.size();
+    rep_seq_list.push_back(n);
+    rep_mask_list.push_back(mask);
+    vector<int> word_list;
+    vector<pair<int,uint32_t> > count_list;
+    seq2words(seq_list[n].norm,k,word_list);
+    count_words(word_list,count_list);
+    for (size_t w=0;w<count_list.size();w++)
+    {
+        WordHit hit={r,count_list[w].second};
+        word_table[count_list[w].first].push_back(hit);
+    }
+}
+
+/* cutoffs, among uncovered, at which sequence n is at least as identical
+ * to a representative in rep_begin..rep_end-1 (a query representative
+ * must not be shorter than n) */
+uint64_t NACluster::cover_mask(const size_t n, const size_t rep_begin,
+    const size_t rep_end, uint64_t uncovered, Workspace &ws)
+{
+    uint64_t covered=0;
+    const string &watson=seq_list[n].norm;
+    int Ls=watson.size();
+    size_t c,r,t;
+    int q;
+    if (ws.shared_list.size()<rep_end) ws.shared_list.resize(rep_end,0);
+    reverse_complement(watson,ws.crick);
+
+    /* for each cutoff, the number e of bases allowed to be not identical
+     * and the word length q of the word filter. Every such base breaks at
+     * most q words, so that at least (Ls-q+1)-q*e words are shared. k,
+     * the indexed word length, is used unless it leaves fewer than a
+     * third of the words to be shared; shorter words then filter better */
+    vector<int> e_list(cut_list.size(),0);
+    vector<int> q_list(cut_list.size(),k);
+    for (c=0;c<cut_list.size();c++)
+    {
+        e_list[c]=ceil((1-cut_list[c])*Ls-1e-6);
+        for (q=k;q>4 && 3*((Ls-q+1)-q*e_list[c])<Ls-q+1;q--);
+        q_list[c]=q;
+    }
+    for (int strand=0;strand<2 && uncovered;strand++)
+    {
+        const string &s=strand?ws.crick:watson;
+        seq2words(s,k,ws.word_list);
+        count_words(ws.word_list,ws.count_list);
+        int Nword[13]={0}; // words without letters other than ACGT
+        for (size_t w=0;w<ws.count_list.size();w++)
+            Nword[k]+=ws.count_list[w].second;
+        for (c=0;c<cut_list.size();c++)
+        {
+            if ((q=q_list[c])==k || ws.qword_list[q].size()) continue;
+            ws.profile_list[q].resize(1<<(2*q),0);
+            ws.used_list[q].resize(1<<(2*q),0);
+            seq2words(s,q,ws.qword_list[q]);
+            for (size_t i=0;i<ws.qword_list[q].size();i++)
+                if (ws.qword_list[q][i]>=0)
+                {
+                    ws.profile_list[q][ws.qword_list[q][i]]++;
+                    Nword[q]++;
+                }
+        }
+
+        /* shared words with every representative */
+        ws.touched_list.clear();
+        for (size_t w=0;w<ws.count_list.size();w++)
+        {
+            const vector<WordHit> &hit_list=word_table[ws.count_list[w].first];
+            uint32_t count=ws.count_list[w].second;
+            for (size_t h=hit_list.size();h>0;h--)
+            {
+                const WordHit &hit=hit_list[h-1];
+                if (hit.rep<rep_begin) break;
+                if (hit.rep>=rep_end) continue;
+                if (ws.shared_list[hit.rep]==0)
+                    ws.touched_list.push_back(hit.rep);
+                ws.shared_list[hit.rep]+=min(count,hit.count);
+            }
+        }
+        if (ws.touched_list.size()==0)
+        {
+            clear_qwords(k,ws);
+            continue;
+        }
+
+        /* positions of words in s for diagonal search */
+        if (ws.head_list.size()==0) ws.head_list.assign(1<<(2*k),-1);
+        ws.next_list.assign(ws.word_list.size(),-1);
+        for (int i=ws.word_list.size()-1;i>=0;i--)
+        {
+            if (ws.word_list[i]<0) continue;
+            ws.next_list[i]=ws.head_list[ws.word_list[i]];
+            ws.head_list[ws.word_list[i]]=i;
+        }
+
+        vector<pair<uint32_t,uint32_t> > order_list;
+        for (t=0;t<ws.touched_list.size();t++)
+        {
+            r=ws.touched_list[t];
+            order_list.push_back(make_pair(ws.shared_list[r],r));
+            ws.shared_list[r]=0;
+        }
+        sort(order_list.rbegin(),order_list.rend());
+        for (t=0;t<order_list.size() && uncovered;t++)
+        {
+            r=order_list[t].second;
+            uint64_t mask=rep_mask_list[r]&uncovered;
+            if (!mask) continue;
+            const string &rep=seq_list[rep_seq_list[r]].norm;
+            if (rep_seq_list[r]<Nquery && rep.size()<watson.size()) continue;
+
+            /* word filter. It decides, as in cd-hit, which pairs are
+             * aligned */
+            uint64_t pass=0;
+            int shared[13]={0};
+            shared[k]=order_list[t].first;
+            for (c=0;c<cut_list.size();c++)
+            {
+                if (!((mask>>c)&1)) continue;
+                q=q_list[c];
+                if (shared[q]==0) shared[q]=shared_qwords(rep,q,ws);
+                if (shared[q]>=max(Nword[q]-q*e_list[c],1))
+                    pass|=((uint64_t)1)<<c;
+            }
+            if (!pass) continue;
+
+            seq2words(rep,k,ws.rep_word_list);
+            int diag=best_diagonal(Ls,ws.rep_word_list,ws);
+
+            /* s is identical to part of rep on the diagonal: the best
+             * possible score, so no alignment is needed */
+            if (diag>=0 && diag+Ls<=(int)rep.size() &&
+                rep.compare(diag,Ls,s)==0)
+            {
+                covered|=pass;
+                uncovered&=~covered;
+                continue;
+            }
+
+            int min_matches=Ls;
+            for (c=0;c<cut_list.size();c++) if ((pass>>c)&1) min_matches=
+                min(min_matches,(int)ceil(cut_list[c]*Ls-1e-6));
+            int matches=align_matches(s,rep,diag,band,min_matches,ws);
+            for (c=0;c<cut_list.size();c++)
+                if (((pass>>c)&1) && matches>=ceil(cut_list[c]*Ls-1e-6))
+                    covered|=((uint64_t)1)<<c;
+            uncovered&=~covered;
+        }
+
+        for (int i=0;i<(int)ws.word_list.size();i++)
+            if (ws.word_list[i]>=0) ws.head_list[ws.word_list[i]]=-1;
+        clear_qwords(k,ws);
+    }
+    return covered;
+}
+
+/* greedy clustering of hits from the longest down. Each batch is first
+ * compared in parallel to representatives chosen before the batch, and
+ * then in order to representatives chosen within the batch. */
+void NACluster::cluster(const size_t min_len)
+{
+    size_t Nseq=seq_list.size();
+    size_t Ncut=cut_list.size();
+    uint64_t all=(Ncut>=64)?~((uint64_t)0):(((uint64_t)1)<<Ncut)-1;
+    size_t n,c;
+    word_table.assign(((size_t)1)<<(2*k),vector<WordHit>());
+    keep_mat.assign(Ncut,vector<char>(Nseq-Nquery,0));
+    for (n=0;n<Nquery;n++) add_rep(n,all);
+
+    /* a later copy of a sequence is covered by the first copy if that
+     * becomes a representative, or else by the same representative */
+    vector<pair<size_t,size_t> > len_list;
+    unordered_set<string> seen_set;
+    for (n=Nquery;n<Nseq;n++)
+        if (seq_list[n].norm.size()>min_len &&
+            seen_set.insert(seq_list[n].norm).second)
+            len_list.push_back(make_pair(seq_list[n].norm.size(),n));
+    seen_set.clear();
+    stable_sort(len_list.begin(),len_list.end(),
+        [](const pair<size_t,size_t> &a, const pair<size_t,size_t> &b)
+        {return a.first>b.first;});
+
+    if (threads<1) threads=1;
+    vector<Workspace> ws_list(threads);
+    size_t Nbatch=256*threads;
+    vector<uint64_t> covered_list;
+    for (size_t b0=0;b0<len_list.size();b0+=Nbatch)
+    {
+        size_t b1=min(b0+Nbatch,len_list.size());
+        size_t rep_begin=rep_seq_list.size();
+        covered_list.assign(b1-b0,0);
+
+        atomic<size_t> next(b0);
+        auto worker=[&](Workspace &ws)
+        {
+            size_t b;
+            while ((b=next.fetch_add(1))<b1) covered_list[b-b0]=
+                cover_mask(len_list[b].second,0,rep_begin,all,ws);
+        };
+        vector<thread> thread_list;
+        for (int t=1;t<threads;t++)
+            thread_list.push_back(thread(worker,ref(ws_list[t])));
+        worker(ws_list[0]);
+        for (size_t t=0;t<thread_list.size();t++) thread_list[t].join();
+
+        for (size_t b=b0;b<b1;b++)
+        {
+            n=len_list[b].second;
+            uint64_t uncovered=all&~covered_list[b-b0];
+            if (uncovered && rep_seq_list.size()>rep_begin) uncovered&=
+                ~cover_mask(n,rep_begin,rep_seq_list.size(),uncovered,
+                ws_list[0]);
+            if (!uncovered) continue;
+            add_rep(n,uncovered);
+            for (c=0;c<Ncut;c++)
+                if ((uncovered>>c)&1) keep_mat[c][n-Nquery]=1;
+        }
+    }
+}
+
+void writeFasta(const string &outfile, const vector<NASeq> &seq_list,
+    const size_t Nquery, const vector<char> &keep_list)
+{
+    ofstream fp;
+    if (outfile!="-") fp.open(outfile.c_str(),ios::out);
+    if (outfile!="-" && !fp.is_open())
+    {
+        cerr<<"ERROR! Cannot write "<<outfile<<endl;
+        exit(1);
+    }
+    ostream &out=(outfile!="-")?fp:cout;
+    for (size_t n=0;n<keep_list.size();n++)
+    {
+        if (!keep_list[n]) continue;
+        const NASeq &seq=seq_list[Nquery+n];
+        if (seq.header.size()) out<<seq.header<<'\n';
+        out<<seq.sequence<<'\n';
+    }
+    if (outfile!="-") fp.close();
+    else cout.flush();
+}
+
+int main(int argc, char **argv)
+{
+    /* parse commad line argument */
+    int min_len=-1;
+    size_t max_seqs=0;
+    int k=10;
+    int threads=1;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if      (arg.substr(0,3)=="-l=") min_len=atoi(arg.substr(3).c_str());
+        else if (arg.substr(0,5)=="-max=")
+            max_seqs=strtoul(arg.substr(5).c_str(),NULL,10);
+        else if (arg.substr(0,3)=="-n=") k=atoi(arg.substr(3).c_str());
+        else if (arg.substr(0,9)=="-threads=")
+            threads=atoi(arg.substr(9).c_str());
+        else if (arg.size()>1 && arg[0]=='-')
+        {
+            cerr<<"ERROR! Unknown option "<<arg<<endl;
+            return 1;
+        }
+        else arg_list.push_back(arg);
+    }
+    if (arg_list.size()<4)
+    {
+        cerr<<docstring;
+        return 0;
+    }
+    string queryfile=arg_list[0];
+    string dbfile   =arg_list[1];
+    string prefix   =arg_list[2];
+
+    NACluster clust;
+    vector<string> cut_str_list;
+    stringstream ss(arg_list[3]);
+    string field;
+    while (getline(ss,field,','))
+    {
+        cut_str_list.push_back(field);
+        clust.cut_list.push_back(atof(field.c_str()));
+    }
+    if (clust.cut_list.size()==0 || clust.cut_list.size()>64)
+    {
+        cerr<<"ERROR! Need 1 to 64 identity cutoffs"<<endl;
+        return 1;
+    }
+    if (k<4 || k>12)
+    {
+        cerr<<"ERROR! Word length -n="<<k<<" is not within 4 to 12"<<endl;
+        return 1;
+    }
+    clust.k=k;
+    clust.band=20;
+    clust.threads=threads;
+
+    readFasta(queryfile,clust.seq_list);
+    clust.Nquery=clust.seq_list.size();
+    if (min_len<0)
+    {
+        size_t Lch=clust.Nquery?clust.seq_list[0].norm.size():0;
+        min_len=(int)(0.4*Lch);
+        if (min_len<10) min_len=9;
+    }
+    readFasta(dbfile,clust.seq_list);
+    clust.cluster(min_len);
+
+    size_t c,max_c=clust.cut_list.size()-1;
+    for (c=0;c<clust.cut_list.size();c++)
+        writeFasta(prefix+'.'+cut_str_list[c],clust.seq_list,clust.Nquery,
+            clust.keep_mat[c]);
+    if (max_seqs)
+    {
+        for (c=0;c<clust.cut_list.size();c++)
+        {
+            size_t Nrep=0;
+            for (size_t n=0;n<clust.keep_mat[c].size();n++)
+                Nrep+=clust.keep_mat[c][n];
+            if (Nrep<max_seqs) break;
+        }
+        if (c>max_c) c=max_c;
+        writeFasta(prefix,clust.seq_list,clust.Nquery,clust.keep_mat[c]);
+    }
+    return 0;
+}
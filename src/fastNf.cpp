@@ -12,6 +12,70 @@ const char* docstring=""
 "fastNf seq.aln 0.8 0 128\n"
 "    The fourth optional argument is target Nf. Stop Nf calculation if\n"
 "    it is already greater than target Nf. default is 0 (no target Nf)\n"
+"\n"
+"Options (may be given anywhere after seq.aln):\n"
+"    -simd=auto   kernel for pairwise sequence identity. Residues are packed\n"
+"                 into 1 to 5 bit-planes, depending on the number of residue\n"
+"                 types in the alignment, and mismatches are counted by\n"
+"                 popcount. auto (default) selects the widest of avx512,\n"
+"                 avx2 and popcnt supported by this CPU.\n"
+"                 scalar forces the original byte-by-byte comparison.\n"
+"    -threads=1   number of threads. The upper triangle of sequence pairs is\n"
+"                 split into cache-sized tiles shared among threads by work\n"
+"                 stealing. Nf is identical for any number of threads.\n"
+"\n"
+"fastNf seq.aln 0.8 0 -id=99,96,93,90 -cov=50,60,70\n"
+"    Report a table of the number of sequences and Nf remaining after\n"
+"    'hhfilter -id $id -cov $cov' for every combination of -id and -cov,\n"
+"    computing each pairwise distance only once. As in hhfilter, the first\n"
+"    (query) sequence is always kept, a sequence is dropped if it has\n"
+"    residues in less than cov% of columns, or if its identity to an\n"
+"    earlier kept sequence over columns aligned by residues in both is\n"
+"    above id%. Sequences are visited in the same order as by hhfilter,\n"
+"    so that the same sequences are kept (see MSAfilter). -id defaults\n"
+"    to 100 (no identity filter) and -cov to 0 (no coverage filter).\n"
+"    target Nf is ignored in this mode.\n"
+"\n"
+"fastNf cmsearch.2.afa 0.8 0 -state=cmsearch.nfstate\n"
+"    Incremental Nf. Load encoded sequences, hashes and neighbour counts\n"
+"    saved by an earlier run from cmsearch.nfstate, compare only the\n"
+"    sequences added (or removed) since then, and save the updated state.\n"
+"    A missing or incompatible state file (different alignment length or\n"
+"    sequence identity cutoff) triggers a full calculation. target Nf is\n"
+"    ignored in this mode.\n"
+"\n"
+"fastNf seq.aln 0.8 0 -approx\n"
+"fastNf seq.aln 0.8 0 -approx=103,14\n"
+"    Approximate Nf in near-linear time by column-sampled locality\n"
+"    sensitive hashing. Sequences are bucketed by their residues at K\n"
+"    random columns, repeated for B bands (default: K such that\n"
+"    0.8^K is about 0.05, and B such that a pair at the identity cutoff\n"
+"    shares a bucket with 99% probability). Only pairs sharing a bucket\n"
+"    are compared. Output is 'Nf Nf_low Nf_high', where Nf_high is the\n"
+"    Nf of verified neighbours (never below the exact Nf) and Nf_low uses\n"
+"    a 95% upper bound on the number of missed neighbours per sequence.\n"
+"    Buckets larger than 1024 sequences are subsampled, in which case\n"
+"    Nf_low is not certified and a warning is printed.\n"
+"\n"
+"fastNf seq.aln 0.8 0 -decide=129\n"
+"    Decide whether Nf>=129 and stop as soon as the answer is certain.\n"
+"    After each band of rows, the Nf of unfinished rows is bounded by\n"
+"    their neighbours counted so far (upper bound) and that count plus\n"
+"    all other unfinished rows (lower bound). Rows are visited in a\n"
+"    strided order that samples the whole alignment early; -decide=129,0\n"
+"    keeps the input order. Output is 'Nf_low Nf_high'; Nf>=129 iff\n"
+"    Nf_low>=129.\n"
+"\n"
+"fastNf seq.aln 0.8 0 -weights=seq.weight\n"
+"    Also write the weight of every sequence, i.e. 1 over the number of\n"
+"    sequences (including itself) above the identity cutoff, to\n"
+"    seq.weight.tsv ('name count weight' per line, where name is the\n"
+"    first word of the header) and to seq.weight.bin. The binary file has\n"
+"    the 8 bytes 'fastNfW1', Nseq and L as uint64, the cutoff as double,\n"
+"    Nseq float weights, and Nseq NUL terminated names. target Nf is\n"
+"    ignored when weights are written. -weights may be combined with\n"
+"    -state, but not with -id/-cov, -decide or -approx, which do not\n"
+"    count the neighbours of every sequence.\n"
 ;
 
 #include <iostream>
@@ -22,121 +86,434 @@ const char* docstring=""
 #include <cmath>
 #include <map>
 #include <bits/stdc++.h> 
+#include <stdint.h>
+#include <immintrin.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "packedMSA.h"
 
 using namespace std;
 
-const char *aa_list="-ACDEFGHIKLMNPQRSTVWY";
+inline bool iverson_bracket(const char *aln_n,const char *aln_m,const size_t L,
+    const size_t maxLdiff)
+{
+    size_t Ldiff=0;
+    for (size_t i=0;i<L;i++)
+    {
+        Ldiff+=(aln_n[i]!=aln_m[i]);
+        if (Ldiff>maxLdiff) return 0; // I[S_{m.n} >= Scut]
+    }
+    return 1;
+}
+
 
-template <class A> void NewArray(A *** array, int Narray1, int Narray2)
+/* return 1 if the two encoded sequences differ at no more than maxLdiff
+ * positions */
+typedef bool (*PairKernel)(const uint64_t *a, const uint64_t *b,
+    const size_t W, const size_t maxLdiff);
+
+bool scalar_kernel(const uint64_t *a, const uint64_t *b,
+    const size_t W, const size_t maxLdiff)
 {
-    *array=new A* [Narray1];
-    for(int i=0; i<Narray1; i++) *(*array+i)=new A [Narray2];
+    return iverson_bracket((const char *)a,(const char *)b,8*W,maxLdiff);
 }
 
-template <class A> void DeleteArray(A *** array, int Narray)
+template <int NB> inline uint64_t plane_diff(const uint64_t *a,
+    const uint64_t *b, const size_t w, const size_t W)
 {
-    for(int i=0; i<Narray; i++)
-        if(*(*array+i)) delete [] *(*array+i);
-    if(Narray) delete [] (*array);
-    (*array)=NULL;
+    uint64_t d=a[w]^b[w];
+    for (int k=1;k<NB;k++) d|=a[k*W+w]^b[k*W+w];
+    return d;
 }
 
-inline bool iverson_bracket(char *aln_n,char  *aln_m,const int L,const int maxLdiff)
+template <int NB> bool popcnt_kernel_generic(const uint64_t *a,
+    const uint64_t *b, const size_t W, const size_t maxLdiff)
 {
-    static int i=0;
-    int Ldiff=0;
-    for (i=0;i<L;i++)
+    size_t Ldiff=0;
+    for (size_t w=0;w<W;w++)
     {
-        Ldiff+=(aln_n[i]!=aln_m[i]);
-        if (Ldiff>maxLdiff) return 0; // I[S_{m.n} >= Scut]
+        Ldiff+=__builtin_popcountll(plane_diff<NB>(a,b,w,W));
+        if (Ldiff>maxLdiff) return 0;
+    }
+    return 1;
+}
+
+template <int NB> __attribute__((target("popcnt")))
+bool popcnt_kernel(const uint64_t *a, const uint64_t *b,
+    const size_t W, const size_t maxLdiff)
+{
+    size_t Ldiff=0;
+    for (size_t w=0;w<W;w++)
+    {
+        Ldiff+=__builtin_popcountll(plane_diff<NB>(a,b,w,W));
+        if (Ldiff>maxLdiff) return 0;
+    }
+    return 1;
+}
+
+/* W is a multiple of 8, so 4 words can always be loaded at once */
+template <int NB> __attribute__((target("avx2")))
+bool avx2_kernel(const uint64_t *a, const uint64_t *b,
+    const size_t W, const size_t maxLdiff)
+{
+    const __m256i lut=_mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                       0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low4=_mm256_set1_epi8(0x0f);
+    __m256i total=_mm256_setzero_si256();
+    __m256i d,cnt;
+    uint64_t lane[4];
+    for (size_t w=0;w<W;w+=4)
+    {
+        d=_mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *)(a+w)),
+            _mm256_loadu_si256((const __m256i *)(b+w)));
+        for (int k=1;k<NB;k++) d=_mm256_or_si256(d,_mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *)(a+k*W+w)),
+            _mm256_loadu_si256((const __m256i *)(b+k*W+w))));
+        cnt=_mm256_add_epi8(
+            _mm256_shuffle_epi8(lut,_mm256_and_si256(d,low4)),
+            _mm256_shuffle_epi8(lut,_mm256_and_si256(
+                _mm256_srli_epi16(d,4),low4)));
+        total=_mm256_add_epi64(total,
+            _mm256_sad_epu8(cnt,_mm256_setzero_si256()));
+        _mm256_storeu_si256((__m256i *)lane,total);
+        if (lane[0]+lane[1]+lane[2]+lane[3]>maxLdiff) return 0;
     }
     return 1;
 }
 
-int aa2int(const string&sequence,char *aln_n)
+template <int NB> __attribute__((target("avx512f,avx512vpopcntdq")))
+bool avx512_kernel(const uint64_t *a, const uint64_t *b,
+    const size_t W, const size_t maxLdiff)
 {
-    int i=0;
-    int j=0;
-    int a=0;
-    for (;i<sequence.size();i++)
+    __m512i total=_mm512_setzero_si512();
+    __m512i d;
+    for (size_t w=0;w<W;w+=8)
     {
-        if (sequence[i]=='-' || ('A'<=sequence[i] && sequence[i]<='Z'))
+        d=_mm512_xor_si512(_mm512_loadu_si512(a+w),_mm512_loadu_si512(b+w));
+        for (int k=1;k<NB;k++) d=_mm512_or_si512(d,_mm512_xor_si512(
+            _mm512_loadu_si512(a+k*W+w),_mm512_loadu_si512(b+k*W+w)));
+        total=_mm512_add_epi64(total,_mm512_popcnt_epi64(d));
+        if ((size_t)_mm512_reduce_add_epi64(total)>maxLdiff) return 0;
+    }
+    return 1;
+}
+
+template <template <int> class K> PairKernel kernel_by_nbits(const int nbits)
+{
+    switch (nbits)
+    {
+        case 1: return K<1>::run;
+        case 2: return K<2>::run;
+        case 3: return K<3>::run;
+        case 4: return K<4>::run;
+    }
+    return K<5>::run;
+}
+
+template <int NB> struct PopcntGeneric { static bool run(const uint64_t *a,
+    const uint64_t *b, const size_t W, const size_t maxLdiff)
+    { return popcnt_kernel_generic<NB>(a,b,W,maxLdiff); } };
+template <int NB> struct Popcnt { static bool run(const uint64_t *a,
+    const uint64_t *b, const size_t W, const size_t maxLdiff)
+    { return popcnt_kernel<NB>(a,b,W,maxLdiff); } };
+template <int NB> struct Avx2 { static bool run(const uint64_t *a,
+    const uint64_t *b, const size_t W, const size_t maxLdiff)
+    { return avx2_kernel<NB>(a,b,W,maxLdiff); } };
+template <int NB> struct Avx512 { static bool run(const uint64_t *a,
+    const uint64_t *b, const size_t W, const size_t maxLdiff)
+    { return avx512_kernel<NB>(a,b,W,maxLdiff); } };
+
+/* simd is one of auto, scalar, popcnt, avx2, avx512. Unsupported
+ * instruction sets fall back to the next narrower one. The name of the
+ * kernel actually used is written back to simd. */
+PairKernel select_kernel(string &simd, const int nbits)
+{
+    if (nbits==0)
+    {
+        simd="scalar";
+        return scalar_kernel;
+    }
+    __builtin_cpu_init();
+    if ((simd=="auto" || simd=="avx512") &&
+        __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vpopcntdq"))
+    {
+        simd="avx512";
+        return kernel_by_nbits<Avx512>(nbits);
+    }
+    if ((simd=="auto" || simd=="avx512" || simd=="avx2") &&
+        __builtin_cpu_supports("avx2"))
+    {
+        simd="avx2";
+        return kernel_by_nbits<Avx2>(nbits);
+    }
+    if (__builtin_cpu_supports("popcnt"))
+    {
+        simd="popcnt";
+        return kernel_by_nbits<Popcnt>(nbits);
+    }
+    simd="generic";
+    return kernel_by_nbits<PopcntGeneric>(nbits);
+}
+
+
+/* all threads wait until every thread has called wait() */
+class Barrier
+{
+public:
+    Barrier(const int count): count(count), waiting(0), generation(0) {}
+    void wait()
+    {
+        unique_lock<mutex> lock(mtx);
+        size_t gen=generation;
+        if (++waiting==count)
         {
-            aln_n[j]=0;
-            for (a=0;a<21;a++)
-            {
-                if (sequence[i]==aa_list[a])
-                {
-                    aln_n[j]=a;
-                    break;
-                }
-            }
-            j++;
+            waiting=0;
+            generation++;
+            cv.notify_all();
         }
+        else cv.wait(lock,[this,gen]{return gen!=generation;});
     }
-    return j; // sequence length
-}
+private:
+    mutex mtx;
+    condition_variable cv;
+    int count;
+    int waiting;
+    size_t generation;
+};
 
-/* return true if length matches L */
-bool getupperseq(const string&sequence,string&upperseq,const int L)
+/* tiles of sequence pairs, split into one contiguous range per thread.
+ * A thread claims tiles from its own range first, then steals from the
+ * ranges of other threads. Owner and thieves share the same atomic cursor
+ * so that each tile is processed exactly once. */
+struct TileQueue
 {
-    int i=0;
-    int j=0;
-    int a=0;
-    upperseq.assign(L,'-');
-    for (;i<sequence.size();i++)
+    vector<pair<size_t,size_t> > tile_list; // (row band, column band)
+    vector<size_t> end_list;
+    atomic<size_t> *next_list;
+    int threads;
+
+    TileQueue(const int threads): next_list(new atomic<size_t>[threads]),
+        threads(threads) {}
+    ~TileQueue() { delete[]next_list; }
+
+    void reset()
     {
-        if (sequence[i]=='-' || ('A'<=sequence[i] && sequence[i]<='Z'))
+        end_list.assign(threads,0);
+        for (int t=0;t<threads;t++)
         {
-            if (j==L) return false;
-            upperseq[j++]=sequence[i];
+            next_list[t]=tile_list.size()*t/threads;
+            end_list[t]=tile_list.size()*(t+1)/threads;
         }
     }
-    return (j==L);
-}
 
-double fastNf(const string infile, const double id_cut=0.8, const int norm=0,
-    double target_Nf=0)
-{
-    /* read alignment */
-    size_t i,j; // index of residue
-    size_t m,n; // index of sequence
-    size_t Nseq=0;
-    size_t L=0;
-    vector<string>aln;
-    string sequence,upperseq;
-    ifstream fp;
-    if (infile!="-") fp.open(infile.c_str(),ios::in);
-    L=0;
-    while ((infile!="-")?fp.good():cin.good())
-    {
-        if (infile!="-") getline(fp,sequence);
-        else getline(cin,sequence);
-
-        if (sequence.length()==0||sequence[0]=='>') continue;
-        if (L==0)
+    bool claim(const int t, size_t &tile)
+    {
+        for (int v=0;v<threads;v++)
         {
-            for (i=0;i<sequence.size();i++) 
-                L+=(sequence[i]=='-' || ('A'<=sequence[i] && sequence[i]<='Z'));
+            int victim=(t+v)%threads;
+            if (next_list[victim].load()>=end_list[victim]) continue;
+            tile=next_list[victim].fetch_add(1);
+            if (tile<end_list[victim]) return true;
         }
-        if (!getupperseq(sequence,upperseq,L))
+        return false;
+    }
+};
+
+/* count neighbours within maxLdiff mismatches for all pairs between row
+ * band [n0,n1) and column band [m0,m1). count_list is private to thread */
+void weight_tile(const EncodedMSA &emsa, PairKernel kernel,
+    const size_t maxLdiff, const size_t n0, const size_t n1,
+    const size_t m0, const size_t m1, size_t *count_list)
+{
+    size_t n,m;
+    bool geScut=false; // greater than or equal to seqID cut?
+    for (n=n0;n<n1;n++)
+    {
+        for (m=(m0>n?m0:n+1);m<m1;m++)
         {
-            cerr<<"ERROR! length (L="<<L
-                <<" mismatch for sequence "<<aln.size()<<endl;
-            exit(0);
+            geScut=kernel(emsa.row(n),emsa.row(m),emsa.W,maxLdiff);
+            count_list[n]+=geScut;
+            count_list[m]+=geScut;
+        }
+    }
+}
+
+/* number of sequences per tile side, so that the rows of two tiles fit
+ * in about 256KB of L2 cache */
+size_t tile_size(const EncodedMSA &emsa)
+{
+    size_t Ntile=256*1024/(2*8*emsa.stride+1);
+    if (Ntile<16)   Ntile=16;
+    if (Ntile>1024) Ntile=1024;
+    return Ntile;
+}
+
+/* bounds on Nf for deciding whether Nf>=T */
+struct NfBounds
+{
+    double T;    // unnormalized threshold
+    double low;  // lower bound of unnormalized Nf
+    double high; // upper bound of unnormalized Nf
+};
+
+/* fill weight_list with the number of sequences (including itself) within
+ * maxLdiff mismatches, and return the unnormalized Nf. If target_Nf>0,
+ * stop when the running sum exceeds target_Nf. Rows are processed in row
+ * bands; after a band, its rows are final and their per-thread counts are
+ * reduced in row order, so Nf does not depend on the number of threads.
+ * If bounds is given, Nf of the remaining rows is bounded after each band,
+ * and calculation stops once Nf>=bounds->T is certain either way. */
+double calc_weight(const EncodedMSA &emsa, PairKernel kernel,
+    const size_t maxLdiff, const double target_Nf, int threads,
+    size_t *weight_list, NfBounds *bounds=NULL)
+{
+    size_t Nseq=emsa.Nseq;
+    size_t Ntile=tile_size(emsa);
+    size_t Nband=(Nseq+Ntile-1)/Ntile;
+    if (threads<1) threads=1;
+    if ((size_t)threads>Nband*(Nband+1)/2) threads=Nband*(Nband+1)/2;
+    if (threads<1) threads=1;
+
+    /* without target_Nf, all bands are processed in one round */
+    size_t Nround_band=(target_Nf>0 || bounds)?1:Nband;
+
+    size_t **count_mat=new size_t*[threads];
+    for (int t=0;t<threads;t++)
+    {
+        count_mat[t]=new size_t[Nseq];
+        for (size_t n=0;n<Nseq;n++) count_mat[t][n]=0;
+    }
+    for (size_t n=0;n<Nseq;n++) weight_list[n]=1;
+
+    TileQueue queue(threads);
+    Barrier barrier(threads);
+    double Nf=0;
+    bool stop=(Nseq==0);
+    size_t band=0;
+
+    auto worker=[&](const int t)
+    {
+        size_t tile,b,c;
+        while (true)
+        {
+            barrier.wait(); // queue is ready
+            if (stop) return;
+            while (queue.claim(t,tile))
+            {
+                b=queue.tile_list[tile].first;
+                c=queue.tile_list[tile].second;
+                weight_tile(emsa,kernel,maxLdiff,
+                    b*Ntile,min((b+1)*Ntile,Nseq),
+                    c*Ntile,min((c+1)*Ntile,Nseq),count_mat[t]);
+            }
+            barrier.wait(); // all tiles in this round are done
+            if (t) continue;
+
+            /* reduce counts of finished rows by the main thread */
+            size_t n1=min((band+Nround_band)*Ntile,Nseq);
+            for (size_t n=band*Ntile;n<n1 && !stop;n++)
+            {
+                for (int t2=0;t2<threads;t2++) weight_list[n]+=count_mat[t2][n];
+                Nf+=1./weight_list[n];
+                if (target_Nf>0 && Nf>target_Nf) stop=true;
+            }
+            band+=Nround_band;
+            if (band>=Nband) stop=true;
+            if (bounds)
+            {
+                bounds->low=bounds->high=Nf;
+                size_t Nleft=Nseq-n1;
+                for (size_t n=n1;n<Nseq;n++)
+                {
+                    size_t weight=1;
+                    for (int t2=0;t2<threads;t2++) weight+=count_mat[t2][n];
+                    bounds->high+=1./weight;
+                    bounds->low +=1./(weight+Nleft-1);
+                }
+                if (bounds->low>=bounds->T || bounds->high<bounds->T)
+                    stop=true;
+            }
+            if (!stop)
+            {
+                queue.tile_list.clear();
+                for (b=band;b<band+Nround_band && b<Nband;b++)
+                    for (c=b;c<Nband;c++)
+                        queue.tile_list.push_back(make_pair(b,c));
+                queue.reset();
+            }
         }
-        aln.push_back(upperseq);
+    };
+
+    if (!stop)
+    {
+        for (size_t b=0;b<Nround_band;b++)
+            for (size_t c=b;c<Nband;c++)
+                queue.tile_list.push_back(make_pair(b,c));
+        queue.reset();
     }
-    if (infile!="-") fp.close();
+    vector<thread> thread_list;
+    for (int t=1;t<threads;t++) thread_list.push_back(thread(worker,t));
+    worker(0);
+    for (int t=1;t<threads;t++) thread_list[t-1].join();
+
+    for (int t=0;t<threads;t++) delete[]count_mat[t];
+    delete[]count_mat;
+    return Nf;
+}
+
+
+/* write weight of every sequence to prefix.tsv and prefix.bin */
+void writeWeights(const string &prefix, const NameList &names,
+    const size_t *weight_list, const size_t L, const double id_cut)
+{
+    uint64_t Nseq=names.name_list.size();
+    uint64_t L64=L;
+    size_t n;
+    vector<float> float_list(Nseq);
+    for (n=0;n<Nseq;n++) float_list[n]=1./weight_list[n];
 
-    /* convert to int */
-    Nseq=aln.size();
-    char **msa;
-    NewArray(&msa, Nseq, L);
-    for (n=0;n<Nseq;n++) aa2int(aln[n],msa[n]);
-    vector<string>().swap(aln);
+    string filename=prefix+".bin";
+    ofstream fp(filename.c_str(),ios::out|ios::binary);
+    fp.write("fastNfW1",8);
+    fp.write((const char *)&Nseq,sizeof(uint64_t));
+    fp.write((const char *)&L64,sizeof(uint64_t));
+    fp.write((const char *)&id_cut,sizeof(double));
+    fp.write((const char *)float_list.data(),Nseq*sizeof(float));
+    for (n=0;n<Nseq;n++)
+        fp.write(names.name_list[n].c_str(),names.name_list[n].size()+1);
+    fp.close();
+    if (!fp.good()) cerr<<"WARNING! Cannot write "<<filename<<endl;
+
+    filename=prefix+".tsv";
+    fp.open(filename.c_str(),ios::out);
+    for (n=0;n<Nseq;n++) fp<<names.name_list[n]<<'\t'<<weight_list[n]
+        <<'\t'<<float_list[n]<<'\n';
+    fp.close();
+    if (!fp.good()) cerr<<"WARNING! Cannot write "<<filename<<endl;
+}
+
+double fastNf(const string infile, const double id_cut=0.8, const int norm=0,
+    double target_Nf=0, string simd="auto", const int threads=1,
+    const string weightfile="")
+{
+    EncodedMSA emsa;
+    NameList names;
+    readMSA(infile,simd,emsa,weightfile.size()?&names:NULL);
+    size_t Nseq=emsa.Nseq;
+    size_t L=emsa.L;
+    PairKernel kernel=select_kernel(simd,emsa.nbits);
 
     /* scale target_Nf by L */
+    if (weightfile.size()) target_Nf=0;
     if (target_Nf>0)
     {
         if (norm==0) target_Nf*=sqrt(L);
@@ -145,30 +522,467 @@ double fastNf(const string infile, const double id_cut=0.8, const int norm=0,
 
     /* calculate weight */
     size_t *weight_list=new size_t[Nseq];
-    for (n=0;n<Nseq;n++) weight_list[n]=1;
-    double Nf=0;
     size_t maxLdiff=(1-id_cut)*L;
-    bool geScut=false; // greater than or equal to seqID cut?
+    double Nf=calc_weight(emsa,kernel,maxLdiff,target_Nf,threads,weight_list);
+    if (weightfile.size()) writeWeights(weightfile,names,weight_list,L,id_cut);
+
+    /* normalize Nf */
+    if (norm==0) Nf/=sqrt(L);
+    else if (norm==1) Nf/=L;
+
+    /* clean up */
+    DeleteAlignedArray(&emsa.data);
+    delete[]weight_list;
+    return Nf;
+}
+
+/* 64-bit FNV-1a hash of residue codes */
+uint64_t hash_codes(const char *codes, const size_t L)
+{
+    uint64_t h=14695981039346656037ULL;
+    for (size_t i=0;i<L;i++)
+    {
+        h^=(unsigned char)codes[i];
+        h*=1099511628211ULL;
+    }
+    return h;
+}
+
+/* state saved by fastNf -state: residue codes, hashes and the number of
+ * neighbours (including itself) of every sequence */
+const char state_magic[8]={'f','a','s','t','N','f','1','\n'};
+
+struct NfState
+{
+    uint64_t L;
+    uint64_t maxLdiff;
+    vector<uint64_t> hash_list;
+    vector<uint64_t> weight_list;
+    vector<char>     code_list;
+};
+
+bool loadState(const string &statefile, NfState &state)
+{
+    ifstream fp(statefile.c_str(),ios::in|ios::binary);
+    if (!fp.good()) return false;
+    char magic[8];
+    uint64_t Nseq=0;
+    fp.read(magic,8);
+    if (!fp.good() || memcmp(magic,state_magic,8)) return false;
+    fp.read((char *)&state.L,sizeof(uint64_t));
+    fp.read((char *)&state.maxLdiff,sizeof(uint64_t));
+    fp.read((char *)&Nseq,sizeof(uint64_t));
+    if (!fp.good()) return false;
+    state.hash_list.resize(Nseq);
+    state.weight_list.resize(Nseq);
+    state.code_list.resize(Nseq*state.L);
+    fp.read((char *)state.hash_list.data(),Nseq*sizeof(uint64_t));
+    fp.read((char *)state.weight_list.data(),Nseq*sizeof(uint64_t));
+    fp.read(state.code_list.data(),Nseq*state.L);
+    return fp.good();
+}
+
+void saveState(const string &statefile, const NfState &state)
+{
+    string tmpfile=statefile+".tmp";
+    ofstream fp(tmpfile.c_str(),ios::out|ios::binary);
+    uint64_t Nseq=state.hash_list.size();
+    fp.write(state_magic,8);
+    fp.write((const char *)&state.L,sizeof(uint64_t));
+    fp.write((const char *)&state.maxLdiff,sizeof(uint64_t));
+    fp.write((const char *)&Nseq,sizeof(uint64_t));
+    fp.write((const char *)state.hash_list.data(),Nseq*sizeof(uint64_t));
+    fp.write((const char *)state.weight_list.data(),Nseq*sizeof(uint64_t));
+    fp.write(state.code_list.data(),Nseq*state.L);
+    fp.close();
+    if (!fp.good() || rename(tmpfile.c_str(),statefile.c_str()))
+        cerr<<"WARNING! Cannot write "<<statefile<<endl;
+}
+
+/* for every pair of query_list[q] and target_list[t] within maxLdiff
+ * mismatches, add 1 to count_list of both rows. If query_list and
+ * target_list are the same list, only pairs with q<t are compared. */
+void count_pairs(const EncodedMSA &emsa, PairKernel kernel,
+    const size_t maxLdiff, const vector<size_t> &query_list,
+    const vector<size_t> &target_list, const bool same_list,
+    int threads, vector<size_t> &count_list)
+{
+    if (threads<1) threads=1;
+    vector<vector<size_t> > count_mat(threads,
+        vector<size_t>(count_list.size(),0));
+    atomic<size_t> next(0);
+    auto worker=[&](const int t)
+    {
+        size_t q,i,n,m;
+        while ((q=next.fetch_add(1))<query_list.size())
+        {
+            n=query_list[q];
+            for (i=(same_list?q+1:0);i<target_list.size();i++)
+            {
+                m=target_list[i];
+                if (!kernel(emsa.row(n),emsa.row(m),emsa.W,maxLdiff))
+                    continue;
+                count_mat[t][n]++;
+                count_mat[t][m]++;
+            }
+        }
+    };
+    vector<thread> thread_list;
+    for (int t=1;t<threads;t++) thread_list.push_back(thread(worker,t));
+    worker(0);
+    for (size_t t=0;t<thread_list.size();t++) thread_list[t].join();
+    for (int t=0;t<threads;t++)
+        for (size_t n=0;n<count_list.size();n++)
+            count_list[n]+=count_mat[t][n];
+}
+
+/* Nf with neighbour counts carried over from statefile. Rows of the
+ * alignment whose codes match a row in the state reuse its count, which
+ * is corrected for removed rows; new rows are compared against all rows. */
+double fastNfState(const string infile, const string statefile,
+    const double id_cut=0.8, const int norm=0, string simd="auto",
+    const int threads=1, const string weightfile="")
+{
+    NfState state;
+    size_t n,m;
+    CodeMatrix codes;
+    NameList names;
+    readCodes(infile,codes,weightfile.size()?&names:NULL);
+    size_t Nseq=codes.Nseq;
+    size_t L=codes.L;
+    size_t maxLdiff=(1-id_cut)*L;
+    state.hash_list.resize(Nseq);
+    state.code_list.resize(Nseq*L);
     for (n=0;n<Nseq;n++)
     {
-        for (m=n+1;m<Nseq;m++)
+        state.hash_list[n]=hash_codes(codes.row(n),L);
+        memcpy(&state.code_list[n*L],codes.row(n),L);
+    }
+
+    /* match rows to rows of old state */
+    NfState old_state;
+    bool reuse=loadState(statefile,old_state) &&
+        old_state.L==L && old_state.maxLdiff==maxLdiff;
+    size_t Nold=reuse?old_state.hash_list.size():0;
+    vector<char> old_used(Nold,0);
+    vector<long long> old_index(Nseq,-1);
+    if (reuse)
+    {
+        map<uint64_t,vector<size_t> > hash2old;
+        for (m=Nold;m>0;m--) hash2old[old_state.hash_list[m-1]].push_back(m-1);
+        for (n=0;n<Nseq;n++)
         {
-            geScut=iverson_bracket(msa[n],msa[m],L,maxLdiff);
-            weight_list[n]+=geScut;
-            weight_list[m]+=geScut;
+            map<uint64_t,vector<size_t> >::iterator it=
+                hash2old.find(state.hash_list[n]);
+            if (it==hash2old.end()) continue;
+            vector<size_t> &old_list=it->second;
+            for (size_t k=old_list.size();k>0;k--)
+            {
+                m=old_list[k-1];
+                if (memcmp(&state.code_list[n*L],&old_state.code_list[m*L],L))
+                    continue;
+                old_index[n]=m;
+                old_used[m]=1;
+                old_list.erase(old_list.begin()+k-1);
+                break;
+            }
         }
-        Nf+=1./weight_list[n];
-        if (target_Nf>0 && Nf>target_Nf) break;
     }
 
+    /* removed old rows are appended after rows of the alignment */
+    vector<size_t> keep_list,add_list,remove_list;
+    for (n=0;n<Nseq;n++)
+    {
+        if (old_index[n]>=0) keep_list.push_back(n);
+        else                 add_list.push_back(n);
+    }
+    for (m=0;m<Nold;m++) if (!old_used[m]) remove_list.push_back(m);
+    if (remove_list.size())
+    {
+        char *data=NewAlignedArray<char>(
+            (Nseq+remove_list.size())*codes.stride);
+        memcpy(data,codes.data,Nseq*codes.stride);
+        DeleteAlignedArray(&codes.data);
+        codes.data=data;
+        for (size_t r=0;r<remove_list.size();r++)
+        {
+            memcpy(codes.row(Nseq+r),&old_state.code_list[remove_list[r]*L],L);
+            memset(codes.row(Nseq+r)+L,0,codes.stride-L);
+            remove_list[r]=Nseq+r;
+        }
+        codes.Nseq=Nseq+remove_list.size();
+    }
+    vector<char>().swap(old_state.code_list);
+    EncodedMSA emsa;
+    encodeMSA(codes,(simd=="scalar")?0:-1,emsa);
+    PairKernel kernel=select_kernel(simd,emsa.nbits);
+
+    /* update neighbour counts */
+    vector<size_t> add_count(emsa.Nseq,0);
+    vector<size_t> remove_count(emsa.Nseq,0);
+    if (keep_list.size() && remove_list.size()) count_pairs(emsa,kernel,
+        maxLdiff,remove_list,keep_list,false,threads,remove_count);
+    if (keep_list.size() && add_list.size()) count_pairs(emsa,kernel,
+        maxLdiff,add_list,keep_list,false,threads,add_count);
+    if (add_list.size()) count_pairs(emsa,kernel,
+        maxLdiff,add_list,add_list,true,threads,add_count);
+    state.weight_list.assign(Nseq,1);
+    double Nf=0;
+    for (n=0;n<Nseq;n++)
+    {
+        if (old_index[n]>=0) state.weight_list[n]=
+            old_state.weight_list[old_index[n]]-remove_count[n];
+        state.weight_list[n]+=add_count[n];
+        Nf+=1./state.weight_list[n];
+    }
+    DeleteAlignedArray(&emsa.data);
+    if (weightfile.size())
+    {
+        vector<size_t> weight_list(state.weight_list.begin(),
+            state.weight_list.end());
+        writeWeights(weightfile,names,weight_list.data(),L,id_cut);
+    }
+
+    state.L=L;
+    state.maxLdiff=maxLdiff;
+    saveState(statefile,state);
+
     /* normalize Nf */
     if (norm==0) Nf/=sqrt(L);
     else if (norm==1) Nf/=L;
+    return Nf;
+}
 
-    /* clean up */
-    DeleteArray(&msa,Nseq);
+/* smallest n such that observing c successes out of n trials with
+ * success rate p has no more than 2.5% probability (normal approximation) */
+double binomial_upper(const double c, const double p)
+{
+    const double z=1.96;
+    double x=(z*sqrt(p*(1-p))+sqrt(z*z*p*(1-p)+4*p*c))/(2*p);
+    return max(c,x*x);
+}
+
+/* approximate Nf by column-sampled LSH with B bands of K columns.
+ * Nf_low and Nf_high are written to the two extra arguments */
+double fastNfApprox(const string infile, double &Nf_low, double &Nf_high,
+    const double id_cut=0.8, const int norm=0, string simd="auto",
+    size_t B=0, size_t K=0)
+{
+    CodeMatrix codes;
+    size_t n,m,b,k,i;
+    readCodes(infile,codes);
+    size_t Nseq=codes.Nseq;
+    size_t L=codes.L;
+    size_t maxLdiff=(1-id_cut)*L;
+    EncodedMSA emsa;
+    encodeMSA(codes,(simd=="scalar")?0:-1,emsa,true);
+    PairKernel kernel=select_kernel(simd,emsa.nbits);
+
+    /* band parameters */
+    double smin=L?1-(double)maxLdiff/L:1; // least identity of neighbours
+    if (K==0) K=(smin>0 && smin<1)?ceil(log(0.05)/log(smin)):1;
+    if (K<1) K=1;
+    double pband=pow(smin,(double)K);
+    if (B==0) B=(pband>=1)?1:ceil(log(0.01)/log(1-pband));
+    if (B<1) B=1;
+    double pmin=1-pow(1-pband,(double)B); // least detection probability
+
+    /* bucket sequences in each band. A bucket is a run of sequences
+     * with the same key in order_list[b], each sequence being paired
+     * with up to max_bucket sequences before and after it */
+    const size_t max_bucket=1024;
+    mt19937_64 rng(20220101);
+    vector<size_t> col_list(K);
+    vector<pair<pair<uint64_t,uint64_t>,size_t> > key_list(Nseq);
+    vector<vector<uint32_t> > order_list(L?B:0,vector<uint32_t>(Nseq));
+    vector<vector<uint32_t> > pos_list(L?B:0,vector<uint32_t>(Nseq));
+    vector<vector<uint32_t> > start_list(L?B:0,vector<uint32_t>(Nseq));
+    size_t Ntruncate=0;
+    for (b=0;b<B && L;b++)
+    {
+        for (k=0;k<K;k++) col_list[k]=rng()%L;
+        for (n=0;n<Nseq;n++)
+        {
+            uint64_t h=14695981039346656037ULL;
+            for (k=0;k<K;k++)
+            {
+                h^=(unsigned char)codes.row(n)[col_list[k]];
+                h*=1099511628211ULL;
+            }
+            /* random second key shuffles sequences within a bucket */
+            key_list[n]=make_pair(make_pair(h,rng()),n);
+        }
+        sort(key_list.begin(),key_list.end());
+        size_t start,end;
+        for (start=0;start<Nseq;start=end)
+        {
+            for (end=start+1;end<Nseq &&
+                key_list[end].first.first==key_list[start].first.first;end++);
+            if (end-start>max_bucket) Ntruncate++;
+            for (i=start;i<end;i++)
+            {
+                order_list[b][i]=key_list[i].second;
+                pos_list[b][key_list[i].second]=i;
+                start_list[b][i]=start;
+            }
+        }
+    }
+    vector<pair<pair<uint64_t,uint64_t>,size_t> >().swap(key_list);
+
+    /* verify the pairs of each sequence n with a later sequence m,
+     * stamping m so that a pair found in several bands is verified once */
+    vector<size_t> count_list(Nseq,0);   // verified neighbours
+    vector<double> ht_list(Nseq,0);      // Horvitz-Thompson estimate
+    vector<uint32_t> last_seen(Nseq,0);  // n+1 if m was paired with n
+    for (n=0;n<Nseq;n++)
+    {
+        for (b=0;b<B && L;b++)
+        {
+            const vector<uint32_t> &order=order_list[b];
+            const vector<uint32_t> &bucket=start_list[b];
+            size_t pos=pos_list[b][n];
+            size_t q=(pos>max_bucket)?pos-max_bucket:0;
+            for (q=max(q,(size_t)bucket[pos]);q<Nseq &&
+                q<=pos+max_bucket && bucket[q]==bucket[pos];q++)
+            {
+                m=order[q];
+                if (m<=n || last_seen[m]==n+1) continue;
+                last_seen[m]=n+1;
+                if (!kernel(emsa.row(n),emsa.row(m),emsa.W,maxLdiff))
+                    continue;
+                size_t Ldiff=0;
+                for (size_t j=0;j<L;j++) Ldiff+=
+                    (codes.row(n)[j]!=codes.row(m)[j]);
+                double p=1-pow(1-pow(1-(double)Ldiff/L,(double)K),
+                               (double)B);
+                count_list[n]++;
+                count_list[m]++;
+                ht_list[n]+=1/p;
+                ht_list[m]+=1/p;
+            }
+        }
+    }
+    if (Ntruncate) cerr<<"WARNING! "<<Ntruncate<<" buckets with more than "
+        <<max_bucket<<" sequences are subsampled. Nf_low is not certified."
+        <<endl;
+
+    double Nf=0;
+    Nf_low=Nf_high=0;
+    for (n=0;n<Nseq;n++)
+    {
+        Nf_high+=1./(1+count_list[n]);
+        Nf_low +=1./(1+binomial_upper(count_list[n],pmin));
+        Nf     +=1./(1+ht_list[n]);
+    }
+    Nf=max(Nf_low,min(Nf_high,Nf));
+    DeleteAlignedArray(&emsa.data);
+    DeleteAlignedArray(&codes.data);
+
+    /* normalize Nf */
+    double scale=1;
+    if (norm==0) scale=sqrt(L);
+    else if (norm==1) scale=L;
+    if (L==0) scale=1;
+    Nf_low/=scale;
+    Nf_high/=scale;
+    return Nf/scale;
+}
+
+/* decide whether Nf>=T by calc_weight with bounds. If reorder is set,
+ * row k of the alignment is visited at position k*P mod Nseq for a P
+ * near 0.618*Nseq and coprime to Nseq, so that early bands sample every
+ * cluster of sequences. Return whether Nf>=T. */
+bool decideNf(const string infile, const double T, double &Nf_low,
+    double &Nf_high, const double id_cut=0.8, const int norm=0,
+    string simd="auto", const int threads=1, const bool reorder=true)
+{
+    EncodedMSA emsa;
+    readMSA(infile,simd,emsa);
+    size_t Nseq=emsa.Nseq;
+    size_t L=emsa.L;
+    PairKernel kernel=select_kernel(simd,emsa.nbits);
+    double scale=1;
+    if (norm==0) scale=sqrt(L);
+    else if (norm==1) scale=L;
+    if (L==0) scale=1;
+
+    if (reorder && Nseq>2)
+    {
+        size_t P=0.618*Nseq;
+        while (__gcd(P,Nseq)!=1) P++;
+        uint64_t *data=NewAlignedArray<uint64_t>(Nseq*emsa.stride);
+        for (size_t k=0;k<Nseq;k++) memcpy(data+(k*P%Nseq)*emsa.stride,
+            emsa.row(k),emsa.stride*sizeof(uint64_t));
+        DeleteAlignedArray(&emsa.data);
+        emsa.data=data;
+    }
+
+    NfBounds bounds;
+    bounds.T=T*scale;
+    bounds.low=bounds.high=0; // an empty alignment has no band
+    size_t *weight_list=new size_t[Nseq];
+    size_t maxLdiff=(1-id_cut)*L;
+    calc_weight(emsa,kernel,maxLdiff,0,threads,weight_list,&bounds);
     delete[]weight_list;
-    return Nf;
+    DeleteAlignedArray(&emsa.data);
+    Nf_low =bounds.low/scale;
+    Nf_high=bounds.high/scale;
+    return bounds.low>=bounds.T;
+}
+
+
+/* Nf and number of sequences after hhfilter for every combination of
+ * id_list (rows) and cov_list (columns) */
+void fastNfTable(const string infile, const vector<double>&id_list,
+    const vector<double>&cov_list, const double id_cut=0.8,
+    const int norm=0, string simd="auto", int threads=1)
+{
+    EncodedMSA emsa;
+    readMSA(infile,simd,emsa);
+    size_t Nseq=emsa.Nseq;
+    size_t L=emsa.L;
+    size_t maxLdiff=(1-id_cut)*L;
+    size_t Ncombo=id_list.size()*cov_list.size();
+    vector<double> combo_id_list(Ncombo,0);
+    vector<double> combo_cov_list(Ncombo,0);
+    size_t c,n;
+    for (c=0;c<Ncombo;c++)
+    {
+        combo_id_list[c] =id_list[c/cov_list.size()];
+        combo_cov_list[c]=cov_list[c%cov_list.size()];
+    }
+    vector<vector<char> > keep_mat;
+    vector<vector<size_t> > weight_mat;
+    hhfilter(emsa,combo_id_list,combo_cov_list,threads,keep_mat,
+        &weight_mat,maxLdiff);
+
+    /* output table */
+    cout<<"#id\tcov\tNseq\tNf"<<endl;
+    for (c=0;c<Ncombo;c++)
+    {
+        double Nf=0;
+        size_t Nkeep=0;
+        for (n=0;n<Nseq;n++)
+        {
+            if (!keep_mat[c][n]) continue;
+            Nkeep++;
+            Nf+=1./weight_mat[c][n];
+        }
+        if (norm==0) Nf/=sqrt(L);
+        else if (norm==1) Nf/=L;
+        cout<<id_list[c/cov_list.size()]<<'\t'<<cov_list[c%cov_list.size()]
+            <<'\t'<<Nkeep<<'\t'<<Nf<<endl;
+    }
+    DeleteAlignedArray(&emsa.data);
+}
+
+/* parse comma separated list of numbers */
+void split_number(const string &line, vector<double> &number_list)
+{
+    stringstream ss(line);
+    string token;
+    while (getline(ss,token,','))
+        if (token.size()) number_list.push_back(atof(token.c_str()));
 }
 
 int main(int argc, char **argv)
@@ -177,19 +991,97 @@ int main(int argc, char **argv)
     double id_cut=0.8; // defined by gremlin
     int norm=0; // 0 - L^0.5, 1 - L, 2 - no normalize
     double target_Nf=0;
-    if(argc<2)
+    string simd="auto";
+    int threads=1;
+    vector<double> id_list;
+    vector<double> cov_list;
+    string statefile="";
+    string weightfile="";
+    bool approx=false;
+    vector<double> decide_list;
+    vector<double> approx_list;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if      (arg.substr(0,6)=="-simd=") simd=arg.substr(6);
+        else if (arg.substr(0,9)=="-threads=")
+            threads=atoi(arg.substr(9).c_str());
+        else if (arg.substr(0,4)=="-id=")  split_number(arg.substr(4),id_list);
+        else if (arg.substr(0,5)=="-cov=") split_number(arg.substr(5),cov_list);
+        else if (arg.substr(0,7)=="-state=") statefile=arg.substr(7);
+        else if (arg.substr(0,9)=="-weights=") weightfile=arg.substr(9);
+        else if (arg.substr(0,8)=="-decide=")
+            split_number(arg.substr(8),decide_list);
+        else if (arg=="-approx") approx=true;
+        else if (arg.substr(0,8)=="-approx=")
+        {
+            approx=true;
+            split_number(arg.substr(8),approx_list);
+        }
+        else if (arg.size()>1 && arg[0]=='-')
+        {
+            cerr<<"ERROR! Unknown option "<<arg<<endl;
+            return 1;
+        }
+        else arg_list.push_back(arg);
+    }
+    if (arg_list.size()<1)
     {
         cerr<<docstring;
         return 0;
     }
-    string infile=argv[1];
-    if (argc>2) id_cut=atof(argv[2]);
+    if (simd!="auto" && simd!="scalar" && simd!="popcnt" &&
+        simd!="avx2" && simd!="avx512")
+    {
+        cerr<<"ERROR! Unknown kernel -simd="<<simd<<endl;
+        return 1;
+    }
+    string infile=arg_list[0];
+    if (arg_list.size()>1) id_cut=atof(arg_list[1].c_str());
     if (id_cut>1) id_cut/=100.;
-    if (argc>3) norm=atoi(argv[3]);
-    if (argc>4) target_Nf=atof(argv[4]);
+    if (arg_list.size()>2) norm=atoi(arg_list[2].c_str());
+    if (arg_list.size()>3) target_Nf=atof(arg_list[3].c_str());
     
+    if (weightfile.size() && (id_list.size() || cov_list.size() ||
+        decide_list.size() || approx))
+    {
+        cerr<<"ERROR! -weights cannot be used with -id, -cov, -decide "
+            <<"or -approx"<<endl;
+        return 1;
+    }
+
     /* calculate Nf*/
-    double Nf=fastNf(infile,id_cut,norm,target_Nf);
+    if (id_list.size() || cov_list.size())
+    {
+        if (id_list.size()==0)  id_list.push_back(100);
+        if (cov_list.size()==0) cov_list.push_back(0);
+        fastNfTable(infile,id_list,cov_list,id_cut,norm,simd,threads);
+        return 0;
+    }
+    double Nf=0;
+    if (decide_list.size())
+    {
+        double Nf_low,Nf_high;
+        decideNf(infile,decide_list[0],Nf_low,Nf_high,id_cut,norm,simd,
+            threads,(decide_list.size()<2 || decide_list[1]!=0));
+        cout<<Nf_low<<'\t'<<Nf_high<<endl;
+        return 0;
+    }
+    if (approx)
+    {
+        double Nf_low,Nf_high;
+        Nf=fastNfApprox(infile,Nf_low,Nf_high,id_cut,norm,simd,
+            (approx_list.size()>0)?approx_list[0]:0,
+            (approx_list.size()>1)?approx_list[1]:0);
+        cout<<Nf<<'\t'<<Nf_low<<'\t'<<Nf_high<<endl;
+        return 0;
+    }
+    if (statefile.size())
+        Nf=fastNfState(infile,statefile,id_cut,norm,simd,threads,
+            weightfile);
+    else Nf=fastNf(infile,id_cut,norm,target_Nf,simd,threads,weightfile);
     cout<<Nf<<endl;
     return 0;
 }
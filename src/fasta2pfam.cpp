@@ -9,44 +9,29 @@ const char* docstring=""
 #include <string>
 #include <cstring>
 #include <cstdlib>
-#include <fstream>
+#include "seqIO.h"
 
 using namespace std;
 
 int fasta2pfam(const string infile="-", const string outfile="-")
 {
-    ifstream fp_in;
-    ofstream fp_out;
-    if (infile!="-") fp_in.open(infile.c_str(),ios::in);
-    if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
-    string sequence,line,header;
+    FastaReader fp_in(infile);
+    BlockWriter fp_out(outfile);
+    TextSpan header,sequence;
     int nseqs=0;
-    while ((infile!="-")?fp_in.good():cin.good())
+    while (fp_in.next(header,sequence))
     {
-        if (infile!="-") getline(fp_in,line);
-        else getline(cin,line);
-
-        if (line.length()==0) continue;
-        if (line[0]=='>')
+        if (sequence.size==0) continue;
+        if (header.size)
         {
-            if (sequence.length()>0)
-            {
-                if (outfile!="-") fp_out<<header<<'\t'<<sequence<<endl;
-                else                cout<<header<<'\t'<<sequence<<endl;
-            }
-            sequence.clear();
-            header=line.substr(1,line.size()-1);
             nseqs++;
+            fp_out.write(header.data+1,header.size-1);
         }
-        else
-            sequence+=line;
+        fp_out.put('\t');
+        fp_out.write(sequence);
+        fp_out.put('\n');
     }
-    fp_in.close();
-    if (outfile!="-") fp_out<<header<<'\t'<<sequence<<endl;
-    else                cout<<header<<'\t'<<sequence<<endl;
     fp_out.close();
-    sequence.clear();
-    header.clear();
     return nseqs;
 }
 
@@ -8,53 +8,46 @@ const char* docstring=""
 #include <string>
 #include <cstring>
 #include <cstdlib>
-#include <fstream>
+#include "seqIO.h"
 
 using namespace std;
 
 size_t fastaNA(const string infile="-", const string outfile="-")
 {
-    ifstream fp_in;
-    ofstream fp_out;
-    if (infile!="-") fp_in.open(infile.c_str(),ios::in);
-    if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
-    string sequence,line;
+    LineReader fp_in(infile);
+    BlockWriter fp_out(outfile);
+    TextSpan line;
+    string sequence;
     size_t nseqs=0;
     size_t i;
     char na;
-    while ((infile!="-")?fp_in.good():cin.good())
+    while (fp_in.next(line))
     {
-        if (infile!="-") getline(fp_in,line);
-        else getline(cin,line);
-
-        if (line.length()==0) continue;
+        if (line.size==0) continue;
         else if (line[0]=='>')
         {
-            if (outfile!="-") fp_out<<line<<endl;
-            else                cout<<line<<endl;
+            fp_out.write(line);
+            fp_out.put('\n');
             nseqs++;
         }
         else
         {
-            for (i=0;i<line.length();i++)
+            sequence.assign(line.data,line.size);
+            for (i=0;i<sequence.size();i++)
             {
-                na=line[i];
+                na=sequence[i];
                 if ('a'<=na && na<='z') na-=32;
                 if      (na=='I') na='A';
                 else if (na=='U') na='T';
                 if ('A'<=na && na<='Z' && (na!='A' && na!='T'
                                        &&  na!='C' && na!='G')) na='N';
-                sequence+=na;
+                sequence[i]=na;
             }
-            if (outfile!="-") fp_out<<sequence<<endl;
-            else                cout<<sequence<<endl;
-            sequence.clear();
+            fp_out.write(sequence);
+            fp_out.put('\n');
         }
     }
-    fp_in.close();
     fp_out.close();
-    sequence.clear();
-    line.clear();
     return nseqs;
 }
 
@@ -0,0 +1,87 @@
+const char* docstring=""
+"fastaUniq input.fasta output.fasta\n"
+"    remove sequences in input.fasta that are identical to an earlier\n"
+"    sequence, keeping the first copy and the input order, in one pass.\n"
+"    The output has one line per sequence. For an alignment whose headers\n"
+"    have no white space, this is the same as\n"
+"    fasta2pfam input.fasta | cat -n | sort -u -k3 | sort -n \\\n"
+"        | grep -ohP '\\S+\\s\\S+$' | pfam2fasta - > output.fasta\n"
+"\n"
+"Options:\n"
+"    -nogap    ignore gaps ('-' and '.') when comparing sequences\n"
+"    -nocase   ignore letter case when comparing sequences\n"
+;
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <unordered_set>
+#include "seqIO.h"
+
+using namespace std;
+
+size_t fastaUniq(const string infile="-", const string outfile="-",
+    const bool nogap=false, const bool nocase=false)
+{
+    FastaReader fp_in(infile);
+    BlockWriter fp_out(outfile);
+    TextSpan header,sequence;
+    unordered_set<SeqHash,SeqHashHasher> seen_set;
+    string key;
+    size_t nseqs=0;
+    size_t i;
+    while (fp_in.next(header,sequence))
+    {
+        if (sequence.size==0) continue;
+        SeqHash hash;
+        if (nogap || nocase)
+        {
+            key.clear();
+            for (i=0;i<sequence.size;i++)
+            {
+                char aa=sequence[i];
+                if (nogap && (aa=='-' || aa=='.')) continue;
+                if (nocase && 'a'<=aa && aa<='z') aa-=32;
+                key+=aa;
+            }
+            hash=hashSeq(key.data(),key.size());
+        }
+        else hash=hashSeq(sequence.data,sequence.size);
+        if (!seen_set.insert(hash).second) continue;
+        nseqs++;
+        fp_out.write(header);
+        fp_out.put('\n');
+        fp_out.write(sequence);
+        fp_out.put('\n');
+    }
+    fp_out.close();
+    return nseqs;
+}
+
+int main(int argc, char **argv)
+{
+    /* parse commad line argument */
+    bool nogap=false;
+    bool nocase=false;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if      (arg=="-nogap")  nogap=true;
+        else if (arg=="-nocase") nocase=true;
+        else arg_list.push_back(arg);
+    }
+    if (arg_list.size()<1)
+    {
+        cerr<<docstring;
+        return 0;
+    }
+    string infile =arg_list[0];
+    string outfile=(arg_list.size()<=1)?"-":arg_list[1];
+    fastaUniq(infile,outfile,nogap,nocase);
+    return 0;
+}
@@ -9,121 +9,138 @@ const char* docstring=""
 #include <vector>
 #include <string>
 #include <cstdlib>
-#include <fstream>
-#include <map>
-#include <climits>
-#include <iomanip>
+#include <stdint.h>
+#include "seqIO.h"
 
 using namespace std;
 
-size_t fixAlnX(const string infile, const char replace, const string outfile)
+/* per column counts of each residue type other than gaps and the one to
+ * be replaced. Residue types are ranked in the order they are first
+ * seen, which breaks ties between equally frequent types */
+class ColumnCount
 {
-    /* read aln file */
-    vector<string> aln;
-    vector<string> header_list;
-    string sequence;
-    size_t L=0;
-    ifstream fp;
-    if (infile!="-") fp.open(infile.c_str(),ios::in);
-    while ((infile!="-")?fp.good():cin.good())
-    {
-        if (infile!="-") getline(fp,sequence);
-        else getline(cin,sequence);
+public:
+    size_t L;
+    size_t Nseq;
+    string aa_list;             // residue types by rank
+    vector<uint32_t> count_mat; // [rank*L+column]
 
-        if (sequence.length()==0) continue;
-        else if (sequence[0]=='>')
-        {
-            header_list.push_back(sequence);
-            continue;
-        }
-        if (L==0) L=sequence.length();
-        else if (sequence.length()!=L)
+    ColumnCount(const char replace): L(0), Nseq(0), replace(replace),
+        rank_list(256,-1) {}
+
+    /* count a row. return false if it is not as long as the first row */
+    bool add(const char *row, const size_t len)
+    {
+        if (Nseq==0) L=len;
+        else if (len!=L) return false;
+        Nseq++;
+        size_t a,j;
+        for (j=0;j<L;j++)
         {
-            cerr<<"ERROR! length not match for sequence\n"<<aln.size();
-            exit(0);
+            unsigned char aa=row[j];
+            if (rank_list[aa]>=0 || aa=='-' || aa=='.' || aa==replace)
+                continue;
+            rank_list[aa]=aa_list.size();
+            aa_list+=aa;
+            count_mat.resize(aa_list.size()*L,0);
         }
-
-        aln.push_back(sequence);
-        if (aln.size()==INT_MAX)
+        /* one pass per residue type, which the compiler vectorizes */
+        for (a=0;a<aa_list.size();a++)
         {
-            cerr<<"WARNING! Cannot read beyond sequence number"<<INT_MAX<<endl;
-            break;
+            uint32_t *count=&count_mat[a*L];
+            const char aa=aa_list[a];
+            for (j=0;j<L;j++) count[j]+=(row[j]==aa);
         }
+        return true;
     }
-    fp.close();
 
-    /* get residue type */
-    string aa_list="";
-    vector<vector<size_t> >aa_count_mat;
-    vector<size_t> aa_count_vec(L,0);
-    size_t seq_num=aln.size();
-    size_t a,i,j;
-    char aa;
-    bool new_aa;
-    for (i=0;i<seq_num;i++)
+    /* most frequent residue type of each column */
+    void best(string &best_list) const
     {
-        for (j=0;j<L;j++)
+        best_list.assign(L,aa_list.size()?aa_list[0]:replace);
+        vector<uint32_t> max_list(count_mat.begin(),
+            count_mat.begin()+(aa_list.size()?L:0));
+        for (size_t a=1;a<aa_list.size();a++)
         {
-            aa=aln[i][j];
-            if (aa=='-' || aa=='.' || aa==replace) continue;
-            new_aa=true;
-            for (a=0;a<aa_list.size();a++)
+            const uint32_t *count=&count_mat[a*L];
+            for (size_t j=0;j<L;j++)
             {
-                if (aa==aa_list[a])
-                {
-                    new_aa=false;
-                    break;
-                }
+                if (count[j]<=max_list[j]) continue;
+                max_list[j]=count[j];
+                best_list[j]=aa_list[a];
             }
-            if (new_aa)
-            {
-                aa_list+=aa;
-                aa_count_mat.push_back(aa_count_vec);
-            }
-            aa_count_mat[a][j]++;
         }
     }
 
-    /* get the most frequent aa type per column */
-    for (j=0;j<L;j++)
-        for (a=0;a<aa_list.size();a++)
-            if (aa_count_mat[a][j]>aa_count_mat[aa_count_vec[j]][j])
-                aa_count_vec[j]=a;
-    
-    vector<vector<size_t> >().swap(aa_count_mat);
-    
-    /* output */
+private:
+    char replace;
+    vector<int> rank_list;      // rank of each residue type, or -1
+};
+
+/* copy of row with residue type replace changed to best_list */
+inline void fixRow(const char *row, const size_t L, const char replace,
+    const string &best_list, char *fixed)
+{
+    for (size_t j=0;j<L;j++) fixed[j]=(row[j]==replace)?best_list[j]:row[j];
+}
+
+/* a regular file is read twice: once to count residues and once to
+ * write fixed rows, so that memory does not grow with the number of
+ * rows. stdin is kept as one block of text and fixed in place. */
+size_t fixAlnX(const string infile, const char replace, const string outfile)
+{
+    ColumnCount counts(replace);
+    string best_list;
+    TextSpan line;
+    LineReader fp(infile);
     string txt;
-    for (i=0;i<seq_num;i++)
+    while (fp.next(line))
     {
-        if (header_list.size()>i) txt+=header_list[i]+'\n';
-        for (j=0;j<L;j++)
+        if (line.size==0) continue;
+        if (line[0]!='>' && !counts.add(line.data,line.size))
         {
-            if (aln[i][j]!=replace) txt+=aln[i][j];
-            else txt+=aa_list[aa_count_vec[j]];
+            cerr<<"ERROR! length not match for sequence\n"<<counts.Nseq;
+            exit(0);
         }
+        if (fp.mapped()) continue;
+        txt.append(line.data,line.size);
         txt+='\n';
     }
+    counts.best(best_list);
 
-    if (outfile=="-") cout<<txt<<flush;
-    else
+    BlockWriter fp_out(outfile);
+    if (!fp.mapped())
     {
-        ofstream fp_out;
-        fp_out.open(outfile.c_str(),ofstream::out);
-        fp_out<<txt;
+        size_t pos,end;
+        for (pos=0;pos<txt.size();pos=end+1)
+        {
+            end=txt.find('\n',pos);
+            if (txt[pos]!='>') fixRow(&txt[pos],end-pos,replace,best_list,
+                &txt[pos]);
+        }
+        fp_out.write(txt);
         fp_out.close();
+        return counts.Nseq;
     }
 
-    /* clean up */
-    vector<string> ().swap(aln);
-    vector<string> ().swap(header_list);
-    sequence.clear();
-    aa_count_vec.clear();
-    txt.clear();
-    return aln.size();
+    LineReader fp2(infile);
+    string fixed(counts.L+1,'\n');
+    while (fp2.next(line))
+    {
+        if (line.size==0) continue;
+        if (line[0]=='>')
+        {
+            fp_out.write(line);
+            fp_out.put('\n');
+            continue;
+        }
+        fixRow(line.data,counts.L,replace,best_list,&fixed[0]);
+        fp_out.write(fixed);
+    }
+    fp_out.close();
+    return counts.Nseq;
 }
 
-
 int main(int argc, char **argv)
 {
     /* parse commad line argument */
@@ -0,0 +1,610 @@
+/* packedMSA.h - reading an alignment into residue codes or bit-planes,
+ * pairwise statistics on packed rows, and hhfilter-style redundancy
+ * filtering. Shared by fastNf and MSAfilter. */
+#ifndef PACKEDMSA_H
+#define PACKEDMSA_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+const char *aa_list="-ACDEFGHIKLMNPQRSTVWY";
+
+/* 64-byte aligned array for rows read by vector kernels */
+template <class A> A *NewAlignedArray(const size_t Narray)
+{
+    void *array=NULL;
+    if (posix_memalign(&array,64,Narray*sizeof(A)+64))
+    {
+        cerr<<"ERROR! Cannot allocate "<<Narray*sizeof(A)<<" bytes"<<endl;
+        exit(1);
+    }
+    return (A *)array;
+}
+
+template <class A> void DeleteAlignedArray(A **array)
+{
+    free(*array);
+    *array=NULL;
+}
+
+/* aa2int() residue codes of Nseq sequences in one 64-byte aligned block.
+ * Each row is padded by 0 to stride bytes, which is a multiple of 64. */
+struct CodeMatrix
+{
+    size_t Nseq;
+    size_t L;
+    size_t stride;
+    char *data;
+    inline char *row(const size_t n) const {return data+n*stride;}
+};
+
+/* MSA encoded for the pairwise identity kernels. With nbits==0, each
+ * residue takes one byte (scalar path). Otherwise, residue codes are
+ * remapped to 0..K-1 and stored as nbits bit-planes of W words each, so
+ * that positions i differ iff any plane differs at bit i. Padding bits
+ * are 0 for all sequences and never count as mismatch. */
+struct EncodedMSA
+{
+    size_t Nseq;
+    size_t L;
+    int    nbits;  // number of bit-planes; 0 for one byte per residue
+    size_t W;      // number of 64-bit words per bit-plane or byte row
+    size_t stride; // number of 64-bit words per sequence
+    int gap_code;  // code of gap '-' in data; -1 if there is no gap
+    uint64_t *data;
+    inline const uint64_t *row(const size_t n) const {return data+n*stride;}
+};
+
+/* residue code of aa2int(): index in aa_list for '-' and A-Z (0 if not
+ * in aa_list), -1 for other characters, which are skipped. With hh, U,
+ * B and Z are read as C, D and E as by hhfilter */
+struct AACode
+{
+    signed char code[256];
+    AACode(const bool hh=false)
+    {
+        for (int c=0;c<256;c++) code[c]=-1;
+        for (int c='A';c<='Z';c++) code[c]=0;
+        for (int a=0;a<21;a++) code[(unsigned char)aa_list[a]]=a;
+        if (!hh) return;
+        code['U']=code['C'];
+        code['B']=code['D'];
+        code['Z']=code['E'];
+    }
+};
+
+static const AACode aa_code;
+static const AACode hh_code(true);
+
+/* write codes of up to L residues in sequence to aln_n.
+ * return the number of residues in sequence */
+inline size_t aa2int(const char *sequence, const size_t len, char *aln_n,
+    const size_t L, const AACode &table=aa_code)
+{
+    size_t j=0;
+    signed char a;
+    for (size_t i=0;i<len;i++)
+    {
+        a=table.code[(unsigned char)sequence[i]];
+        if (a<0) continue;
+        if (j<L) aln_n[j]=a;
+        j++;
+    }
+    return j; // sequence length
+}
+
+/* choose bit-planes for the residue codes flagged in used_list, and
+ * allocate zeroed rows for Nseq sequences of length L in emsa */
+void setupPacking(const bool used_list[21], const size_t Nseq,
+    const size_t L, EncodedMSA &emsa, int code2dense[21])
+{
+    int a,K=0;
+    for (a=0;a<21;a++) code2dense[a]=used_list[a]?K++:-1;
+    for (emsa.nbits=1;(1<<emsa.nbits)<K;emsa.nbits++);
+    emsa.gap_code=code2dense[0];
+    emsa.Nseq=Nseq;
+    emsa.L=L;
+    emsa.W=(L+511)/512*8; // multiple of 8 words for 512-bit registers
+    emsa.stride=emsa.nbits*emsa.W;
+    emsa.data=NewAlignedArray<uint64_t>(Nseq*emsa.stride);
+    memset(emsa.data,0,sizeof(uint64_t)*Nseq*emsa.stride);
+}
+
+/* set bit-planes of one row from L residue codes */
+inline void packRow(const char *codes, const int code2dense[21],
+    const EncodedMSA &emsa, uint64_t *row)
+{
+    int a,k;
+    for (size_t i=0;i<emsa.L;i++)
+    {
+        a=code2dense[(int)codes[i]];
+        for (k=0;k<emsa.nbits;k++)
+            if ((a>>k)&1) row[k*emsa.W+i/64]|=((uint64_t)1)<<(i%64);
+    }
+}
+
+/* encode MSA from aa2int() residue codes. nbits==0 keeps one byte per
+ * residue; nbits<0 packs with the fewest bit-planes that distinguish all
+ * residue types present in the alignment. Unless keep_codes is set, the
+ * code matrix is released (or, for nbits==0, taken over by emsa). */
+void encodeMSA(CodeMatrix &codes, int nbits, EncodedMSA &emsa,
+    const bool keep_codes=false)
+{
+    size_t n,i;
+    size_t Nseq=codes.Nseq;
+    size_t L=codes.L;
+    emsa.Nseq=Nseq;
+    emsa.L=L;
+    if (nbits==0)
+    {
+        emsa.nbits=0;
+        emsa.gap_code=0;
+        emsa.W=codes.stride/8;
+        emsa.stride=emsa.W;
+        if (keep_codes)
+        {
+            emsa.data=NewAlignedArray<uint64_t>(Nseq*emsa.stride);
+            memcpy(emsa.data,codes.data,Nseq*codes.stride);
+        }
+        else
+        {
+            emsa.data=(uint64_t *)codes.data;
+            codes.data=NULL;
+        }
+        return;
+    }
+
+    /* remap residue codes to 0..K-1 */
+    bool used_list[21]={false};
+    for (n=0;n<Nseq;n++)
+        for (i=0;i<L;i++) used_list[(int)codes.row(n)[i]]=true;
+    int code2dense[21];
+    setupPacking(used_list,Nseq,L,emsa,code2dense);
+    for (n=0;n<Nseq;n++)
+        packRow(codes.row(n),code2dense,emsa,emsa.data+n*emsa.stride);
+    if (!keep_codes) DeleteAlignedArray(&codes.data);
+}
+
+/* name of every sequence: the first word of the last header before it,
+ * or an empty string if there is none */
+struct NameList
+{
+    vector<string> name_list;
+    string header;
+
+    void add_header(const char *line, const size_t len)
+    {
+        size_t i;
+        for (i=1;i<len && !isspace(line[i]);i++);
+        header.assign(line+1,i-1);
+    }
+    void add_sequence()
+    {
+        name_list.push_back(header);
+        header.clear();
+    }
+};
+
+/* append one line of alignment to codes. Header and empty lines are
+ * skipped. capacity is the number of rows to allocate in codes, which is
+ * doubled whenever it is full. */
+inline void add_line(const char *line, const size_t len, CodeMatrix &codes,
+    size_t &capacity, NameList *names=NULL, const AACode &table=aa_code)
+{
+    if (len==0) return;
+    if (line[0]=='>')
+    {
+        if (names) names->add_header(line,len);
+        return;
+    }
+    if (names) names->add_sequence();
+    if (codes.L==0)
+    {
+        codes.L=aa2int(line,len,NULL,0,table);
+        codes.stride=(codes.L+63)/64*64;
+    }
+    if (codes.data==NULL || codes.Nseq==capacity)
+    {
+        if (codes.data) capacity*=2;
+        else if (capacity==0) capacity=64;
+        char *data=NewAlignedArray<char>(capacity*codes.stride);
+        if (codes.Nseq) memcpy(data,codes.data,codes.Nseq*codes.stride);
+        DeleteAlignedArray(&codes.data);
+        codes.data=data;
+    }
+    char *row=codes.row(codes.Nseq);
+    if (aa2int(line,len,row,codes.L,table)!=codes.L)
+    {
+        cerr<<"ERROR! length (L="<<codes.L
+            <<" mismatch for sequence "<<codes.Nseq<<endl;
+        exit(0);
+    }
+    memset(row+codes.L,0,codes.stride-codes.L);
+    codes.Nseq++;
+}
+
+/* drop mapped pages between released and pos from memory in chunks of
+ * 16MB, so that the resident size of the mapping stays small */
+inline void release_pages(char *&released, const char *pos)
+{
+    static const size_t chunk=16<<20;
+    if (pos-released<(long)chunk) return;
+    madvise(released,chunk,MADV_DONTNEED);
+    released+=chunk;
+}
+
+/* memory map a regular non-empty file for sequential reading.
+ * return NULL for stdin and files that cannot be mapped */
+char *mapFile(const string &infile, size_t &size)
+{
+    if (infile=="-") return NULL;
+    int fd=open(infile.c_str(),O_RDONLY);
+    if (fd<0) return NULL;
+    struct stat st;
+    if (fstat(fd,&st) || !S_ISREG(st.st_mode) || st.st_size==0)
+    {
+        close(fd);
+        return NULL;
+    }
+    size=st.st_size;
+    char *buf=(char *)mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (buf==MAP_FAILED) return NULL;
+    madvise(buf,size,MADV_SEQUENTIAL);
+    return buf;
+}
+
+/* end of the line starting at line */
+inline const char *line_end(const char *line, const char *last)
+{
+    const char *end=(const char *)memchr(line,'\n',last-line);
+    return end?end:last;
+}
+
+/* read alignment as aa2int() residue codes. A regular file is memory
+ * mapped and the number of rows is counted before a single allocation;
+ * stdin is read line by line into a growing matrix. */
+void readCodes(const string infile, CodeMatrix &codes, NameList *names=NULL)
+{
+    codes.Nseq=codes.L=codes.stride=0;
+    codes.data=NULL;
+    size_t capacity=0;
+    size_t size=0;
+    char *buf=mapFile(infile,size);
+    if (buf)
+    {
+        const char *line,*end;
+        const char *last=buf+size;
+        char *released=buf;
+        for (line=buf;line<last;line=end+1)
+        {
+            end=line_end(line,last);
+            capacity+=(end>line && line[0]!='>');
+            release_pages(released,line);
+        }
+        released=buf;
+        for (line=buf;line<last;line=end+1)
+        {
+            end=line_end(line,last);
+            add_line(line,end-line,codes,capacity,names);
+            release_pages(released,line);
+        }
+        munmap(buf,size);
+        return;
+    }
+
+    string sequence;
+    ifstream fp;
+    if (infile!="-") fp.open(infile.c_str(),ios::in);
+    while ((infile!="-")?fp.good():cin.good())
+    {
+        if (infile!="-") getline(fp,sequence);
+        else getline(cin,sequence);
+        add_line(sequence.data(),sequence.size(),codes,capacity,names);
+    }
+    if (infile!="-") fp.close();
+}
+
+/* read alignment and encode it for the pairwise identity kernels.
+ * Rows of a memory mapped file are packed straight into bit-planes
+ * after a first pass collects the residue types, without a code matrix */
+void readMSA(const string infile, const string &simd, EncodedMSA &emsa,
+    NameList *names=NULL)
+{
+    size_t size=0;
+    char *buf=(simd=="scalar")?NULL:mapFile(infile,size);
+    if (!buf)
+    {
+        CodeMatrix codes;
+        readCodes(infile,codes,names);
+        encodeMSA(codes,(simd=="scalar")?0:-1,emsa);
+        return;
+    }
+
+    const char *line,*end,*c;
+    const char *last=buf+size;
+    char *released=buf;
+    size_t Nseq=0;
+    size_t L=0;
+    bool used_list[21]={false};
+    signed char a;
+    for (line=buf;line<last;line=end+1)
+    {
+        end=line_end(line,last);
+        release_pages(released,line);
+        if (end==line || line[0]=='>') continue;
+        Nseq++;
+        if (L==0) L=aa2int(line,end-line,NULL,0);
+        for (c=line;c<end;c++)
+            if ((a=aa_code.code[(unsigned char)*c])>=0) used_list[(int)a]=true;
+    }
+
+    int code2dense[21];
+    setupPacking(used_list,Nseq,L,emsa,code2dense);
+    vector<char> row_codes(L,0);
+    size_t n=0;
+    released=buf;
+    for (line=buf;line<last;line=end+1)
+    {
+        end=line_end(line,last);
+        release_pages(released,line);
+        if (end==line) continue;
+        if (line[0]=='>')
+        {
+            if (names) names->add_header(line,end-line);
+            continue;
+        }
+        if (names) names->add_sequence();
+        if (aa2int(line,end-line,row_codes.data(),L)!=L)
+        {
+            cerr<<"ERROR! length (L="<<L
+                <<" mismatch for sequence "<<n<<endl;
+            exit(0);
+        }
+        packRow(row_codes.data(),code2dense,emsa,emsa.data+n*emsa.stride);
+        n++;
+    }
+    munmap(buf,size);
+}
+
+/* mask of columns with a residue (not gap) for every sequence, using the
+ * same W words per row as one bit-plane of emsa */
+void nongap_mask(const EncodedMSA &emsa, vector<uint64_t> &mask_list)
+{
+    size_t n,w,i;
+    int k;
+    size_t W=(emsa.L+63)/64;
+    mask_list.assign(emsa.Nseq*W,0);
+    for (n=0;n<emsa.Nseq;n++)
+    {
+        const uint64_t *row=emsa.row(n);
+        uint64_t *mask=&mask_list[n*W];
+        if (emsa.nbits==0)
+        {
+            const char *aln=(const char *)row;
+            for (i=0;i<emsa.L;i++)
+                if (aln[i]) mask[i/64]|=((uint64_t)1)<<(i%64);
+            continue;
+        }
+        for (w=0;w<W;w++)
+        {
+            uint64_t eq=~((uint64_t)0);
+            if (emsa.gap_code<0) eq=0;
+            else for (k=0;k<emsa.nbits;k++)
+                eq&=((emsa.gap_code>>k)&1)?row[k*emsa.W+w]:~row[k*emsa.W+w];
+            mask[w]=~eq;
+        }
+        if (emsa.L%64) mask[W-1]&=(((uint64_t)1)<<(emsa.L%64))-1;
+    }
+}
+
+/* mismatches of a pair of sequences over all columns (Ldiff), and over
+ * columns where both sequences have residues (Ndiff, out of Noverlap) */
+struct PairStats
+{
+    uint32_t Ldiff;
+    uint32_t Ndiff;
+    uint32_t Noverlap;
+};
+
+inline __attribute__((always_inline)) void pair_stats_body(
+    const EncodedMSA &emsa, const vector<uint64_t> &mask_list,
+    const size_t n, const size_t m, PairStats &stats)
+{
+    size_t W=(emsa.L+63)/64;
+    const uint64_t *a=emsa.row(n);
+    const uint64_t *b=emsa.row(m);
+    const uint64_t *mask_a=&mask_list[n*W];
+    const uint64_t *mask_b=&mask_list[m*W];
+    size_t w,i;
+    uint64_t d,both;
+    int k;
+    stats.Ldiff=stats.Ndiff=stats.Noverlap=0;
+    if (emsa.nbits==0)
+    {
+        const char *aln_n=(const char *)a;
+        const char *aln_m=(const char *)b;
+        for (i=0;i<emsa.L;i++)
+        {
+            stats.Ldiff+=(aln_n[i]!=aln_m[i]);
+            if (aln_n[i]==0 || aln_m[i]==0) continue;
+            stats.Noverlap++;
+            stats.Ndiff+=(aln_n[i]!=aln_m[i]);
+        }
+        return;
+    }
+    for (w=0;w<W;w++)
+    {
+        d=a[w]^b[w];
+        for (k=1;k<emsa.nbits;k++) d|=a[k*emsa.W+w]^b[k*emsa.W+w];
+        both=mask_a[w]&mask_b[w];
+        stats.Ldiff   +=__builtin_popcountll(d);
+        stats.Noverlap+=__builtin_popcountll(both);
+        stats.Ndiff   +=__builtin_popcountll(d&both);
+    }
+}
+
+void pair_stats_generic(const EncodedMSA &emsa,
+    const vector<uint64_t> &mask_list, const size_t n, const size_t m,
+    PairStats &stats)
+{
+    pair_stats_body(emsa,mask_list,n,m,stats);
+}
+
+__attribute__((target("popcnt"))) void pair_stats_popcnt(
+    const EncodedMSA &emsa, const vector<uint64_t> &mask_list,
+    const size_t n, const size_t m, PairStats &stats)
+{
+    pair_stats_body(emsa,mask_list,n,m,stats);
+}
+
+/* order in which hhfilter visits sequences: the query first, then by
+ * decreasing number of residues nres. Ties are broken exactly as by the
+ * quicksort of hhfilter, so that the same sequences are kept. */
+void hhfilter_order(const vector<size_t> &nres, vector<size_t> &order)
+{
+    size_t Nseq=nres.size();
+    size_t i,left,right,last;
+    order.resize(Nseq);
+    for (i=0;i<Nseq;i++) order[i]=i;
+    vector<pair<size_t,size_t> > range_list;
+    if (Nseq>2) range_list.push_back(make_pair(1,Nseq-1));
+    while (range_list.size())
+    {
+        left =range_list.back().first;
+        right=range_list.back().second;
+        range_list.pop_back();
+        if (left>=right) continue;
+        swap(order[left],order[(left+right)/2]);
+        last=left;
+        for (i=left+1;i<=right;i++)
+            if (nres[order[i]]>nres[order[left]]) swap(order[++last],order[i]);
+        swap(order[left],order[last]);
+        range_list.push_back(make_pair(left,last-1));
+        range_list.push_back(make_pair(last+1,right));
+    }
+}
+
+/* hhfilter for every combination c of maximum pairwise sequence identity
+ * id_list[c] and minimum coverage cov_list[c], both in percent. Visiting
+ * sequences in hhfilter_order(), a sequence is kept if it has residues
+ * in at least cov% of the L columns and if, over columns where both have
+ * residues, it is less than id% identical to all sequences kept before.
+ * The query is always kept. keep_mat[c][n] is 1 for kept sequences.
+ * If weight_mat is given, weight_mat[c][n] is the number of sequences
+ * kept for c, including n, that differ from kept sequence n at no more
+ * than maxLdiff of all L columns.
+ * Pair statistics are computed in parallel for a block of sequences
+ * against all earlier ones; the block is then filtered in order. */
+void hhfilter(const EncodedMSA &emsa, const vector<double> &id_list,
+    const vector<double> &cov_list, int threads,
+    vector<vector<char> > &keep_mat,
+    vector<vector<size_t> > *weight_mat=NULL, const size_t maxLdiff=0)
+{
+    size_t Nseq=emsa.Nseq;
+    size_t L=emsa.L;
+    size_t Ncombo=id_list.size();
+    size_t W=(L+63)/64;
+    size_t c,n,m,p,q,w;
+    vector<uint64_t> mask_list;
+    nongap_mask(emsa,mask_list);
+    __builtin_cpu_init();
+    void (*pair_stats)(const EncodedMSA &, const vector<uint64_t> &,
+        const size_t, const size_t, PairStats &)=pair_stats_generic;
+    if (emsa.nbits && __builtin_cpu_supports("popcnt"))
+        pair_stats=pair_stats_popcnt;
+    if (threads<1) threads=1;
+
+    vector<size_t> nres(Nseq,0);
+    for (n=0;n<Nseq;n++)
+        for (w=0;w<W;w++) nres[n]+=__builtin_popcountll(mask_list[n*W+w]);
+    vector<size_t> order;
+    hhfilter_order(nres,order);
+
+    vector<double> maxNdiff_frac(Ncombo,0);
+    for (c=0;c<Ncombo;c++) maxNdiff_frac[c]=0.9999-0.01*id_list[c];
+    keep_mat.assign(Ncombo,vector<char>(Nseq,0));
+    if (weight_mat) weight_mat->assign(Ncombo,vector<size_t>(Nseq,1));
+    vector<char> keep_any(Nseq,0); // by position in order
+    vector<char> cand_list(Ncombo,0);
+
+    /* about 64MB of pair statistics per block of positions */
+    size_t Nblock=(Nseq==0)?1:(64<<20)/(sizeof(PairStats)*Nseq);
+    if (Nblock<1) Nblock=1;
+    vector<PairStats> stats_list;
+    for (size_t p0=0;p0<Nseq;p0+=Nblock)
+    {
+        size_t p1=min(p0+Nblock,Nseq);
+        stats_list.resize((p1-p0)*p1);
+
+        /* pair statistics of block positions vs all earlier positions */
+        size_t Nchunk=(p1-p0)*((p1+1023)/1024);
+        atomic<size_t> next(0);
+        auto worker=[&]()
+        {
+            size_t chunk,p,q;
+            while ((chunk=next.fetch_add(1))<Nchunk)
+            {
+                p=p0+chunk%(p1-p0);
+                size_t q0=chunk/(p1-p0)*1024;
+                for (q=q0;q<q0+1024 && q<p;q++)
+                    if (keep_any[q] || q>=p0) pair_stats(emsa,mask_list,
+                        order[p],order[q],stats_list[(p-p0)*p1+q]);
+            }
+        };
+        vector<thread> thread_list;
+        for (int t=1;t<threads;t++) thread_list.push_back(thread(worker));
+        worker();
+        for (size_t t=0;t<thread_list.size();t++) thread_list[t].join();
+
+        /* greedy filter in hhfilter order */
+        for (p=p0;p<p1;p++)
+        {
+            PairStats *stats=&stats_list[(p-p0)*p1];
+            n=order[p];
+            bool any=false;
+            for (c=0;c<Ncombo;c++)
+            {
+                cand_list[c]=(p==0 || 100.*nres[n]>=cov_list[c]*L);
+                any|=cand_list[c];
+            }
+            if (!any) continue;
+            for (q=0;q<p;q++)
+            {
+                if (!keep_any[q]) continue;
+                m=order[q];
+                for (c=0;c<Ncombo;c++)
+                    if (cand_list[c] && keep_mat[c][m] && stats[q].Ndiff<
+                        maxNdiff_frac[c]*stats[q].Noverlap) cand_list[c]=0;
+            }
+            for (c=0;c<Ncombo;c++)
+            {
+                if (!cand_list[c]) continue;
+                keep_mat[c][n]=keep_any[p]=1;
+                if (!weight_mat) continue;
+                for (q=0;q<p;q++)
+                {
+                    m=order[q];
+                    if (!keep_mat[c][m] || stats[q].Ldiff>maxLdiff) continue;
+                    (*weight_mat)[c][n]++;
+                    (*weight_mat)[c][m]++;
+                }
+            }
+        }
+    }
+}
+
+#endif
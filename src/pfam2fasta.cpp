@@ -14,51 +14,41 @@ const char* docstring=""
 #include <string>
 #include <cstring>
 #include <cstdlib>
-#include <fstream>
+#include "seqIO.h"
 
 using namespace std;
 
 int pfam2fasta(const string infile="-", const string outfile="-",
     const int maxLineAAnum=0)
 {
-    ifstream fp_in;
-    ofstream fp_out;
-    if (infile!="-") fp_in.open(infile.c_str(),ios::in);
-    if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
-    string txt,line;
+    LineReader fp_in(infile);
+    BlockWriter fp_out(outfile);
+    TextSpan line;
     int nseqs=0;
-    int i,j;
-    while ((infile!="-")?fp_in.good():cin.good())
+    size_t i,j;
+    while (fp_in.next(line))
     {
-        if (infile!="-") getline(fp_in,line);
-        else getline(cin,line);
-
-        for (i=0;i<line.size();i++)
+        const char *tab=(const char *)memchr(line.data,'\t',line.size);
+        if (!tab) continue;
+        nseqs++;
+        i=tab-line.data;
+        fp_out.put('>');
+        fp_out.write(line.data,i);
+        fp_out.put('\n');
+        TextSpan sequence(tab+1,line.size-i-1);
+        if (maxLineAAnum<=0 || sequence.size==0)
+        {
+            fp_out.write(sequence);
+            fp_out.put('\n');
+            continue;
+        }
+        for (j=0;j<sequence.size;j+=maxLineAAnum)
         {
-            if (line[i]=='\t')
-            {
-                nseqs++;
-                txt='>'+line.substr(0,i)+'\n';
-                line=line.substr(i+1);
-                if (maxLineAAnum==0) txt+=line;
-                else
-                {
-                    for (j=0;j<line.size();j+=60)
-                    {
-                        if (j+60>line.size())
-                            txt+=line.substr(j,line.size()-j)+'\n';
-                        else
-                            txt+=line.substr(j,60)+'\n';
-                    }
-                }
-                if (outfile!="-") fp_out<<txt.substr(0,txt.size()-1)<<endl;
-                else                cout<<txt.substr(0,txt.size()-1)<<endl;
-                txt.clear();
-                break;
-            }
+            fp_out.write(sequence.data+j,
+                min((size_t)maxLineAAnum,sequence.size-j));
+            fp_out.put('\n');
         }
     }
-    fp_in.close();
     fp_out.close();
     return nseqs;
 }
@@ -1,8 +1,22 @@
 const char* docstring=""
-"rFUpred seq.ct seq.FU\n"
+"rFUpred [-float|-band] [-threads=1] [-recursive] seq.ct seq.FU\n"
 "    Split input RNA secondary structure file seq.ct into domains by\n"
 "    the FUpred algorithm. Output likely domain boundaries to seq.FU.\n"
 "    Each domain must have at least one base pair.\n"
+"    seq.ct may also be a dot-bracket file, whose structure line has\n"
+"    pairs (), [], {}, <> and Aa to Zz for pseudoknots, and may follow\n"
+"    a header line \">name\" and a sequence line.\n"
+"\n"
+"rFUpred -list [-threads=1] ct.list all.FU\n"
+"    Predict each CT file listed in ct.list, one per line. A CT file may\n"
+"    be followed by its own output file; otherwise its output is written\n"
+"    to all.FU after a line \">seq.ct\", in the order of ct.list.\n"
+"\n"
+"rFUpred -multi [-threads=1] all.ct all.FU\n"
+"    Predict each structure of multi structure CT file all.ct, where a\n"
+"    structure starts at a header line or at nucleotide 1, or of a multi\n"
+"    record dot-bracket file. Each output in all.FU follows a line\n"
+"    \">header\".\n"
 "\n"
 "Output format:\n"
 "    FUscore - a smaller Folding Unit score means a more likely boundary.\n"
@@ -13,6 +27,20 @@ const char* docstring=""
 "    (domain1)linker(domain2) - boundaries of two domains with linker.\n"
 "             linker is in the format is i-j. if i<=j, i and j are the\n"
 "             linker boundaries; if i=j-1, there is no linker.\n"
+"\n"
+"Options:\n"
+"    -float   store the FU score matrix in float instead of double, which\n"
+"             halves its memory. Scores may differ in the last digits\n"
+"    -band    do not store the FU score matrix, but compute three rows at\n"
+"             a time and other scores when read, for long RNAs. The output\n"
+"             is the same as by default\n"
+"    -recursive   split the structure at its best boundary, then split each\n"
+"             of the two domains again, while the FUscore is below 1.\n"
+"             Output one line per split: depth, FUscore, DC, the domain\n"
+"             that is split and its two domains\n"
+"    -threads=1   number of threads. Structures of -list or -multi are\n"
+"             predicted in parallel; a single structure of at least 1000\n"
+"             nucleotides fills its FU score matrix in parallel\n"
 ;
 
 #include <iostream>
@@ -24,6 +52,8 @@ const char* docstring=""
 #include <sstream>
 #include <algorithm>
 #include <iomanip>
+#include <thread>
+#include <atomic>
 
 using namespace std;
 
@@ -46,100 +76,473 @@ void split(const string &line, vector<string> &line_vec)
     }
 }
 
-void rFUpred(const string infile="-", const string outfile="-")
+/* base pair counts of a structure of L nucleotides. count(x,y) is the
+ * number of base pairs i<j with i<x and j<y, for 0<=x,y<=L. Pairs are
+ * kept in the order of i, with a Fenwick tree of their sorted j, so that
+ * memory grows with L+Nbp*log(Nbp) rather than L*L */
+class BasePairCount
 {
-    /* parse input file */
-    ifstream fp_in;
-    ofstream fp_out;
-    string line;
-    vector<string> line_vec;
-    if (infile!="-") fp_in.open(infile.c_str(),ios::in);
+public:
+    long int L;
+    long int Nbp;
+
+    BasePairCount(const long int L, const vector<long int> &resi1_vec,
+        const vector<long int> &resi2_vec): L(L)
+    {
+        vector<pair<long int,long int> > pair_list;
+        for (size_t bp=0;bp<resi1_vec.size();bp++)
+            pair_list.push_back(make_pair(min(max(resi1_vec[bp],0L),L-1),
+                                          min(max(resi2_vec[bp],0L),L-1)));
+        build(pair_list);
+    }
+
+    /* pairs of a domain of parent, which is made of the sorted ranges
+     * [first,second) of segment_list, with nucleotides numbered along the
+     * domain. Pairs are sliced from the pairs of parent by the range of i
+     * in each segment, so the structure is not read or sorted again */
+    BasePairCount(const BasePairCount &parent,
+        const vector<pair<long int,long int> > &segment_list): L(0)
+    {
+        vector<pair<long int,long int> > pair_list;
+        long int offset=0, offset2, bp, j;
+        size_t s,s2;
+        for (s=0;s<segment_list.size();s++)
+        {
+            const long int start=segment_list[s].first;
+            const long int end  =segment_list[s].second;
+            for (bp=parent.i_cum[start];bp<parent.i_cum[end];bp++)
+            {
+                j=parent.j_list[bp];
+                offset2=offset;
+                for (s2=s;s2<segment_list.size() &&
+                    j>=segment_list[s2].second;s2++)
+                    offset2+=segment_list[s2].second-segment_list[s2].first;
+                if (s2<segment_list.size() && j>=segment_list[s2].first)
+                    pair_list.push_back(make_pair(offset+parent.i_list[bp]-
+                        start,offset2+j-segment_list[s2].first));
+            }
+            offset+=end-start;
+        }
+        L=offset;
+        build(pair_list);
+    }
+
+    /* O(1) if x or y is L, or if y<=x, else O(log(Nbp)^2) */
+    long int count(const long int x, const long int y) const
+    {
+        if (x>=L || y<=x) return j_cum[y];
+        if (y>=L) return i_cum[x];
+        long int n=0;
+        for (long int t=i_cum[x];t>0;t-=t&-t)
+            n+=lower_bound(tree_j.begin()+tree_start[t],
+                tree_j.begin()+tree_start[t+1],y)-
+                (tree_j.begin()+tree_start[t]);
+        return n;
+    }
+
+    /* count_list[y]=count(x,y) for 0<=y<=L, in O(L+Nbp) */
+    void row(const long int x, vector<long int> &count_list) const
+    {
+        count_list.assign(L+1,0);
+        long int k,y;
+        for (k=0;k<i_cum[x];k++) count_list[j_list[k]+1]++;
+        for (y=1;y<=L;y++) count_list[y]+=count_list[y-1];
+    }
+
+private:
+    vector<long int> i_cum;      // i_cum[x] is the number of pairs with i<x
+    vector<long int> j_cum;      // j_cum[y] is the number of pairs with j<y
+    vector<long int> i_list;     // pairs in the order of i
+    vector<long int> j_list;
+    vector<long int> tree_start; // start of node t in tree_j
+    vector<long int> tree_j;
+
+    void build(vector<pair<long int,long int> > &pair_list)
+    {
+        long int x,bp,t;
+        Nbp=pair_list.size();
+        i_cum.assign(L+1,0);
+        j_cum.assign(L+1,0);
+        sort(pair_list.begin(),pair_list.end());
+        for (bp=0;bp<Nbp;bp++)
+        {
+            i_list.push_back(pair_list[bp].first);
+            j_list.push_back(pair_list[bp].second);
+            i_cum[pair_list[bp].first+1]++;
+            j_cum[pair_list[bp].second+1]++;
+        }
+        for (x=1;x<=L;x++)
+        {
+            i_cum[x]+=i_cum[x-1];
+            j_cum[x]+=j_cum[x-1];
+        }
+
+        /* node t holds j of pairs t-(t&-t) to t-1 in sorted order */
+        tree_start.assign(Nbp+2,0);
+        for (t=1;t<=Nbp;t++)
+        {
+            tree_start[t]=tree_j.size();
+            tree_j.insert(tree_j.end(),j_list.begin()+t-(t&-t),
+                j_list.begin()+t);
+            sort(tree_j.begin()+tree_start[t],tree_j.end());
+        }
+        tree_start[Nbp+1]=tree_j.size();
+    }
+};
+
+/* FU score of a discontinuous domain pos1..pos2-1 inserted between the
+ * N-terminal part 0..pos1-1 and the C-terminal part pos2..L-1, where
+ * 1<=pos1<pos2<L and nc=count(pos1,pos2). sele is set if all three parts
+ * and the pairs between N- and C-terminal parts have a base pair */
+inline double FUscore2d(const BasePairCount &bp_count,
+    const long int pos1, const long int pos2, const long int nc, bool &sele)
+{
+    const long int L=bp_count.L;
+    long int in=bp_count.count(pos1,L);     // i<pos1
+    long int ic=bp_count.count(pos2,L);     // i<pos2
+    long int jn=bp_count.count(L,pos1);     // j<pos1
+    long int jc=bp_count.count(L,pos2);     // j<pos2
+    double Nn2,N2c,Nn,Nc,Nnc,N2;
+    Nn =1+jn;                  // j<pos1
+    Nn2=1+nc-jn;               // i<pos1 && pos1<=j<pos2
+    Nnc=1+in-nc;               // i<pos1 && pos2<=j
+    N2 =1+jc-nc;               // pos1<=i && j<pos2
+    N2c=1+ic-in-(jc-nc);       // pos1<=i<pos2 && pos2<=j
+    Nc =1+bp_count.Nbp-ic;     // pos2<=i
+    sele=(Nn>1 && Nc>1 && N2>1 && Nnc>1);
+    //return 2*(Nn2+N2c)*(1./(Nn+Nc)+1./(2*Nnc)+1./N2); // in RNA
+    return 2*(Nn2+N2c)*(1./(Nn+Nc+2*Nnc)+1./N2); // in protein
+}
+
+/* symmetric matrix of FU score 2d. The diagonal is the FU score of one
+ * boundary, and row 0 repeats row 1. Cells 1<=pos1<pos2<L are stored as
+ * a packed triangle of double ('d') or float ('f'), or, for the band
+ * mode ('b'), only in the three rows around the row moved to, while
+ * other cells are counted again when they are read */
+class FUscoreMatrix
+{
+public:
+    FUscoreMatrix(const BasePairCount &bp_count,
+        const vector<double> &FUscore_list, const char mode,
+        int threads=1): bp_count(bp_count), FUscore_list(FUscore_list),
+        mode(mode)
+    {
+        L=bp_count.L;
+        n=max(L-1,0L);
+        if (mode=='b')
+        {
+            band_mat.assign(3*L,0);
+            row_id[0]=row_id[1]=row_id[2]=-1;
+            return;
+        }
+        if (mode=='f') float_list.assign(n*(n-1)/2,0);
+        else          double_list.assign(n*(n-1)/2,0);
+
+        /* rows are filled in parallel for long RNAs */
+        atomic<long int> next(1);
+        auto worker=[&]()
+        {
+            vector<long int> count_list;
+            long int pos1,pos2;
+            bool sele;
+            double score;
+            while ((pos1=next.fetch_add(1))<L)
+            {
+                bp_count.row(pos1,count_list);
+                for (pos2=pos1+1;pos2<L;pos2++)
+                {
+                    score=FUscore2d(bp_count,pos1,pos2,count_list[pos2],sele);
+                    if (mode=='f') float_list[index(pos1,pos2)]=score;
+                    else          double_list[index(pos1,pos2)]=score;
+                }
+            }
+        };
+        if (L<1000) threads=1;
+        vector<thread> thread_list;
+        for (int t=1;t<threads;t++) thread_list.push_back(thread(worker));
+        worker();
+        for (size_t t=0;t<thread_list.size();t++) thread_list[t].join();
+    }
+
+    double operator()(long int pos1, long int pos2) const
+    {
+        if (pos1>pos2) swap(pos1,pos2);
+        if (pos1==0) pos1=1;
+        if (pos1>=pos2) return FUscore_list[pos2];
+        if (mode=='d') return double_list[index(pos1,pos2)];
+        if (mode=='f') return float_list[index(pos1,pos2)];
+        if (row_id[pos1%3]==pos1) return band_mat[(pos1%3)*L+pos2];
+        bool sele;
+        return FUscore2d(bp_count,pos1,pos2,bp_count.count(pos1,pos2),sele);
+    }
+
+    /* in band mode, keep rows pos-1 to pos+1 */
+    void moveTo(const long int pos)
+    {
+        if (mode!='b') return;
+        long int pos1,pos2;
+        bool sele;
+        for (pos1=max(pos-1,1L);pos1<=pos+1 && pos1<L;pos1++)
+        {
+            if (row_id[pos1%3]==pos1) continue;
+            row_id[pos1%3]=pos1;
+            double *band_row=&band_mat[(pos1%3)*L];
+            bp_count.row(pos1,count_list);
+            for (pos2=pos1+1;pos2<L;pos2++) band_row[pos2]=
+                FUscore2d(bp_count,pos1,pos2,count_list[pos2],sele);
+        }
+    }
+
+private:
+    const BasePairCount &bp_count;
+    const vector<double> &FUscore_list;
+    char mode;
+    long int L;
+    long int n;                  // size of the triangle
+    vector<double> double_list;  // packed triangle
+    vector<float>  float_list;
+    vector<double> band_mat;     // [(pos1%3)*L+pos2]
+    long int row_id[3];          // pos1 of each row in band_mat
+    vector<long int> count_list;
+
+    /* position of 1<=pos1<pos2<L in the packed triangle */
+    inline size_t index(const long int pos1, const long int pos2) const
+    {
+        return (size_t)(pos1-1)*(2*n-pos1)/2+pos2-pos1-1;
+    }
+};
+
+/* an RNA secondary structure of L nucleotides, with base pairs i<j
+ * numbered from 0 */
+struct Structure
+{
+    string name;
+    long int L;
     vector<long int> resi1_vec;
     vector<long int> resi2_vec;
-    long int i,j;
-    long int L=0;
-    while ((infile!="-")?fp_in.good():cin.good())
+};
+
+/* whether word may be a structure in dot-bracket notation, rather than a
+ * header line ">name" or a title such as "E.coli" or "tRNA.Phe" */
+inline bool isDotBracket(const string &word)
+{
+    if (word[0]=='>') return false;
+    bool bracket=false;
+    for (size_t i=0;i<word.size();i++)
+    {
+        if (word[i]=='.' && i && i+1<word.size() &&
+            isalpha(word[i-1]) && isalpha(word[i+1])) return false;
+        if (strchr(".()[]{}<>",word[i])) bracket=true;
+        else if (!strchr("-_,:~",word[i]) && !isalpha(word[i])) return false;
+    }
+    return bracket;
+}
+
+/* structure in dot-bracket notation. (), [], {}, <> and Aa to Zz are
+ * pairs, so that pseudoknots can be written, and other characters are
+ * unpaired */
+void readDotBracket(const string &dbn, Structure &ct)
+{
+    const string open_list ="([{<ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const string close_list=")]}>abcdefghijklmnopqrstuvwxyz";
+    vector<vector<long int> > stack_list(open_list.size());
+    long int i;
+    size_t k;
+    ct.L=dbn.size();
+    for (i=0;i<ct.L;i++)
     {
-        if (infile!="-") getline(fp_in,line);
-        else getline(cin,line);
-        if (line.size()==0 || line[0]=='#') continue;
-        split(line,line_vec);
-        if (line_vec.size()>=6)
+        if ((k=open_list.find(dbn[i]))!=string::npos)
+        {
+            stack_list[k].push_back(i);
+            continue;
+        }
+        if ((k=close_list.find(dbn[i]))==string::npos) continue;
+        if (stack_list[k].size()==0)
         {
-            L++;
-            i=atol(line_vec[0].c_str());
-            j=atol(line_vec[4].c_str());
-            if (i<j)
+            cerr<<"WARNING! unpaired "<<dbn[i]<<" at "<<i+1<<endl;
+            continue;
+        }
+        ct.resi1_vec.push_back(stack_list[k].back());
+        ct.resi2_vec.push_back(i);
+        stack_list[k].pop_back();
+    }
+    for (k=0;k<stack_list.size();k++) if (stack_list[k].size())
+        cerr<<"WARNING! unpaired "<<open_list[k]<<" at "
+            <<stack_list[k].back()+1<<endl;
+}
+
+inline bool isInteger(const string &word)
+{
+    size_t i=(word.size() && (word[0]=='-' || word[0]=='+'));
+    if (i>=word.size()) return false;
+    for (;i<word.size();i++) if (word[i]<'0' || word[i]>'9') return false;
+    return true;
+}
+
+/* structures of a CT file or of stdin ("-"). By default the whole input
+ * is one structure and every line of six or more columns is a nucleotide.
+ * With multi, a structure also ends before a header line, which is any
+ * line that is not a nucleotide, and before nucleotide 1. A line that
+ * starts with a dot-bracket structure, and is the first line or follows a
+ * header line ">name" or a sequence line, is a whole structure, named by
+ * the last header line before it */
+class CTReader
+{
+public:
+    CTReader(const string &infile, const bool multi=false):
+        infile(infile), multi(multi), pending(false), done(false),
+        follow_seq(true)
+    {
+        if (infile!="-")
+        {
+            fp_in.open(infile.c_str(),ios::in);
+            if (!fp_in.is_open())
             {
-                resi1_vec.push_back(i-1);
-                resi2_vec.push_back(j-1);
+                cerr<<"ERROR! Cannot read "<<infile<<endl;
+                exit(1);
             }
         }
-        line_vec.clear();
-        line.clear();
     }
-    vector<string>().swap(line_vec);
-    fp_in.close();
+
+    bool next(Structure &ct)
+    {
+        ct.name.clear();
+        ct.L=0;
+        ct.resi1_vec.clear();
+        ct.resi2_vec.clear();
+        long int i,j;
+        bool found=false;
+        if (!multi)
+        {
+            if (done) return false;
+            done=true;
+        }
+        while (pending || nextLine())
+        {
+            pending=false;
+            if (follow_seq && !isNucleotide() && isDotBracket(line_vec[0]))
+            {
+                if (ct.L) return pending=true;
+                readDotBracket(line_vec[0],ct);
+                return true;
+            }
+            if (multi && !isNucleotide())
+            {
+                if (ct.L) return pending=true;
+                /* a sequence line does not rename a dot-bracket record */
+                if (line[0]=='>' || ct.name.empty())
+                {
+                    ct.name=line.substr(line.find_first_not_of(" \t>"));
+                    ct.name.erase(ct.name.find_last_not_of(" \t\r")+1);
+                }
+                found=true;
+                continue;
+            }
+            if (line_vec.size()>=6)
+            {
+                i=atol(line_vec[0].c_str());
+                if (multi && i==1 && ct.L) return pending=true;
+                found=true;
+                ct.L++;
+                j=atol(line_vec[4].c_str());
+                if (i<j)
+                {
+                    ct.resi1_vec.push_back(i-1);
+                    ct.resi2_vec.push_back(j-1);
+                }
+            }
+        }
+        return found || !multi;
+    }
+
+private:
+    string infile;
+    bool multi;
+    bool pending;      // line is the first line of the next structure
+    bool done;         // the only structure is read, without multi
+    bool follow_seq;   // line is the first line, or follows a header or
+                       // sequence line
+    ifstream fp_in;
+    string line;
+    vector<string> line_vec;
+
+    /* whether line is a nucleotide of a CT file */
+    bool isNucleotide() const
+    {
+        return line_vec.size()>=6 && isInteger(line_vec[0]) &&
+            isInteger(line_vec[2]) && isInteger(line_vec[4]);
+    }
+
+    /* next line that is not empty or a comment */
+    bool nextLine()
+    {
+        follow_seq=line_vec.empty() || line[0]=='>';
+        if (!follow_seq && line_vec.size()==1)
+        {
+            follow_seq=true;
+            for (size_t i=0;i<line.size() && follow_seq;i++)
+                follow_seq=isalpha(line[i]) || isspace(line[i]);
+        }
+        while ((infile!="-")?fp_in.good():cin.good())
+        {
+            if (infile!="-") getline(fp_in,line);
+            else getline(cin,line);
+            if (line.size()==0 || line[0]=='#') continue;
+            line_vec.clear();
+            split(line,line_vec);
+            if (line_vec.size()) return true;
+        }
+        return false;
+    }
+};
+
+/* candidate domain boundary. The two domains are [0,mid1)+[mid2,L) and
+ * [mid1,mid2), where mid2 is L for two continuous domains. Candidates are
+ * sorted by score and then by the line txt of seq.FU */
+struct Linker
+{
+    double score;
+    string txt;
+    long int mid1,mid2;
+
+    Linker(const double score, const string &txt, const long int mid1,
+        const long int mid2): score(score), txt(txt), mid1(mid1), mid2(mid2) {}
+
+    bool operator<(const Linker &other) const
+    {
+        return score<other.score || (score==other.score && txt<other.txt);
+    }
+};
+
+/* candidate domain boundaries of a structure, sorted by FU score */
+void FUpred(const BasePairCount &bp_count, const char mode,
+    const int threads, vector<Linker> &linker_list)
+{
+    const long int L=bp_count.L;
+    long int i,j;
 
     /* calculate FU score */
     vector<double>FUscore_list(L,0);
-    vector<vector<double> >FUscore2d_mat(L,FUscore_list);
     vector<bool> FUsele_list(L,false);
-    vector<vector<bool> >FUsele2d_mat(L,FUsele_list);
-    vector<bool>().swap(FUsele_list);
-    long int pos, bp;
+    long int pos;
     double N12,N1,N2;
     for (pos=1;pos<L;pos++)
     {
-        N12=N1=N2=1; // 1 is pseudo count to avoid division of 0
-        for (bp=0;bp<resi1_vec.size();bp++)
-        {
-            i=resi1_vec[bp];
-            j=resi2_vec[bp];
-            if      (j<pos) N1++;
-            else if (i<pos  && pos<=j) N12++;
-            else if (pos<=i) N2++;
-        }
+        // 1 is pseudo count to avoid division of 0
+        N1 =1+bp_count.count(L,pos);                        // j<pos
+        N12=1+bp_count.count(pos,L)-bp_count.count(L,pos);  // i<pos<=j
+        N2 =1+bp_count.Nbp-bp_count.count(pos,L);           // pos<=i
         FUscore_list[pos]=2*N12*(1./N1+1./N2);
-        FUsele2d_mat[pos][pos]=(N1>1 && N2>1);
+        FUsele_list[pos]=(N1>1 && N2>1);
     }
     if (L>1) FUscore_list[0]=FUscore_list[1];
     
     /* calculate FU score 2d */
     long int pos1,pos2;
-    double Nn2,N2c,Nn,Nc,Nnc;
-    for (pos1=1;pos1<L;pos1++)
-    {
-        FUscore2d_mat[pos1][pos1]=FUscore_list[pos1];
-        for (pos2=pos1+1;pos2<L;pos2++)
-        {
-            Nn=Nnc=N2=Nc=1;
-            Nn2=N2c=1;
-            for (bp=0;bp<resi1_vec.size();bp++)
-            {
-                i=resi1_vec[bp];
-                j=resi2_vec[bp];
-                if      (j<pos1) Nn++;
-                else if (i<pos1 && pos1<=j && j<pos2) Nn2++;
-                else if (i<pos1 && pos2<=j) Nnc++;
-                else if (pos1<=i && j<pos2) N2++;
-                else if (pos1<=i && i<pos2 && pos2<=j) N2c++;
-                else if (pos2<=i) Nc++;
-            }
-            FUscore2d_mat[pos1][pos2]=FUscore2d_mat[pos2][pos1]=
-                //2*(Nn2+N2c)*(1./(Nn+Nc)+1./(2*Nnc)+1./N2); // in RNA
-                2*(Nn2+N2c)*(1./(Nn+Nc+2*Nnc)+1./N2); // in protein
-            FUsele2d_mat[pos1][pos2]=(Nn>1 && Nc>1 && N2>1 && Nnc>1);
-        }
-        if (L>1) FUscore2d_mat[pos1][0]=
-                 FUscore2d_mat[0][pos1]=FUscore2d_mat[pos1][1];
-    }
-    if (L>1) FUscore2d_mat[0][0]=FUscore2d_mat[1][1];
+    FUscoreMatrix FUscore2d_mat(bp_count,FUscore_list,mode,threads);
 
     /* sort position by FU score */
-    vector<long int>().swap(resi1_vec);
-    vector<long int>().swap(resi2_vec);
-    vector<pair<double,string> > linker_list;
+    linker_list.clear();
     vector<char> type_list;
     //vector<pair<double,vector<long int> > > resi_list;
     //vector<long int> resi_vec;
@@ -165,12 +568,12 @@ void rFUpred(const string infile="-", const string outfile="-")
         }
         if (accept==false) continue;
         mid=(resi1+resi2)/2;
-        if (!FUsele2d_mat[mid][mid]) continue;
+        if (!FUsele_list[mid]) continue;
         ss<<setiosflags(ios::fixed)<<setprecision(6)<<score
           <<"\tC\t(1-"<<mid<<")("<<mid+1<<"-"<<L<<")\t(1-"<<resi1
           <<")"<<resi1+1<<"-"<<resi2<<"("<<resi2+1<<"-"<<L<<")\t";
         ss.flush();
-        linker_list.push_back(make_pair(score,ss.str()));
+        linker_list.push_back(Linker(score,ss.str(),mid,L));
         type_list.push_back('c');
         ss.str("");
         //for (i=resi1;i<=resi2;i++) resi_vec.push_back(i);
@@ -182,71 +585,73 @@ void rFUpred(const string infile="-", const string outfile="-")
     long int midn,midc,resi1n,resi2n,resi1c,resi2c;
     for (pos1=2;pos1<L-1;pos1++)
     {
+        FUscore2d_mat.moveTo(pos1);
         resi1n=resi2n=pos1;
         for (pos2=pos1+3;pos2<L-1;pos2++)
         {
             resi1c=resi2c=pos2;
-            score=FUscore2d_mat[pos1][pos2];
+            score=FUscore2d_mat(pos1,pos2);
             accept=true;
             if (score>=FUscore_list[pos1] ||
                 score>=FUscore_list[pos2] ||
-                score>=FUscore2d_mat[pos1-1][pos2-1] ||
-                score>=FUscore2d_mat[pos1-1][pos2]   ||
-                score>=FUscore2d_mat[pos1][pos2-1]   ||
-                score> FUscore2d_mat[pos1+1][pos2]   ||
-                score> FUscore2d_mat[pos1][pos2+1]   ||
-                score> FUscore2d_mat[pos1+1][pos2+1]) continue;
+                score>=FUscore2d_mat(pos1-1,pos2-1) ||
+                score>=FUscore2d_mat(pos1-1,pos2)   ||
+                score>=FUscore2d_mat(pos1,pos2-1)   ||
+                score> FUscore2d_mat(pos1+1,pos2)   ||
+                score> FUscore2d_mat(pos1,pos2+1)   ||
+                score> FUscore2d_mat(pos1+1,pos2+1)) continue;
             for (resi2n=pos1;resi2n<=pos2;resi2n++)
             {
                 if (score>=FUscore_list[resi2n] ||
-                    score> FUscore2d_mat[resi2n+1][pos2])
+                    score> FUscore2d_mat(resi2n+1,pos2))
                 {
                     accept=false;
                     break;
                 }
-                else if (score<FUscore2d_mat[resi2n+1][pos2]) break;
+                else if (score<FUscore2d_mat(resi2n+1,pos2)) break;
             }
             if (accept==false) continue;
             for (resi2c=pos2;resi2c<L-1;resi2c++)
             {
                 if (score>=FUscore_list[resi2c] ||
-                    score> FUscore2d_mat[resi2n][resi2c+1])
+                    score> FUscore2d_mat(resi2n,resi2c+1))
                 {
                     accept=false;
                     break;
                 }
-                if (score<FUscore2d_mat[resi2n][resi2c+1]) break;
+                if (score<FUscore2d_mat(resi2n,resi2c+1)) break;
             }
             if (accept==false) continue;
-            if (score>=FUscore2d_mat[resi1n-1][resi2c+1] ||
-                score>=FUscore2d_mat[resi2n+1][resi1c-1] ||
-                score>=FUscore2d_mat[resi2n+1][resi2c+1]) continue;
+            if (score>=FUscore2d_mat(resi1n-1,resi2c+1) ||
+                score>=FUscore2d_mat(resi2n+1,resi1c-1) ||
+                score>=FUscore2d_mat(resi2n+1,resi2c+1)) continue;
             for (i=resi1n;i<=resi2n;i++)
             {
-                if (score<FUscore2d_mat[i][resi1c-1] ||
-                    score<FUscore2d_mat[i][resi2c+1]) continue;
+                if (score<FUscore2d_mat(i,resi1c-1) ||
+                    score<FUscore2d_mat(i,resi2c+1)) continue;
                 accept=true;
                 break;
             }
             if (accept==false) continue;
             for (j=resi1c;j<=resi2c;j++)
             {
-                if (score<FUscore2d_mat[resi1n-1][j] ||
-                    score<FUscore2d_mat[resi2n+1][j]) continue;
+                if (score<FUscore2d_mat(resi1n-1,j) ||
+                    score<FUscore2d_mat(resi2n+1,j)) continue;
                 accept=true;
                 break;
             }
             if (accept==false) continue;
             midn=(resi1n+resi2n)/2;
             midc=(resi1c+resi2c)/2;
-            if (!FUsele2d_mat[midn][midc]) continue;
+            FUscore2d(bp_count,midn,midc,bp_count.count(midn,midc),accept);
+            if (accept==false) continue;
             ss<<setiosflags(ios::fixed)<<setprecision(6)<<score
               <<"\tD\t(1-"<<midn<<","<<midc+1<<"-"<<L<<")("<<midn+1
               <<"-"<<midc<<")\t(1-"<<resi1n<<","<<resi2c+1<<"-"<<L<<")"
               <<resi1n+1<<"-"<<resi2n<<","<<resi1c+1<<"-"<<resi2c
               <<"("<<resi2n+1<<"-"<<resi1c<<")\t";
             ss.flush();
-            linker_list.push_back(make_pair(score,ss.str()));
+            linker_list.push_back(Linker(score,ss.str(),midn,midc));
             type_list.push_back('D');
             ss.str("");
             //for (i=resi1n;i<=resi2n;i++) resi_vec.push_back(i);
@@ -255,18 +660,17 @@ void rFUpred(const string infile="-", const string outfile="-")
             //resi_vec.clear();
         }
     }
-    vector<double>().swap(FUscore_list);
-    vector<vector<double> >().swap(FUscore2d_mat);
-    vector<vector<bool> >().swap(FUsele2d_mat);
-
-    /* output result */
+    vector<bool>().swap(FUsele_list);
     sort(linker_list.begin(),linker_list.end());
     //sort(resi_list.begin(),resi_list.end());
-    if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
-    line="#FUscore\tDC\t(domain1)(domain2)\t(domain1)linker(domain2)";
-    if (outfile=="-") cout<<line<<endl;
-    else            fp_out<<line<<endl;
-    vector<bool> sele_list(L,false);
+}
+
+/* output of candidate domain boundaries, as written to seq.FU */
+void writeFU(const vector<Linker> &linker_list, string &txt)
+{
+    txt="#FUscore\tDC\t(domain1)(domain2)\t(domain1)linker(domain2)\n";
+    size_t pos;
+    //vector<bool> sele_list(L,false);
     int total_accepted=0;
     for (pos=0;pos<linker_list.size();pos++)
     {
@@ -280,32 +684,235 @@ void rFUpred(const string infile="-", const string outfile="-")
         //if (accept==false) continue;
 
         if (total_accepted<10) total_accepted++;
-        else if (linker_list[pos].first>=1) break;
+        else if (linker_list[pos].score>=1) break;
 
-        if (outfile=="-") cout<<linker_list[pos].second<<endl;
-        else            fp_out<<linker_list[pos].second<<endl;
+        txt+=linker_list[pos].txt+'\n';
         
         //for (i=0;i<resi_list[pos].second.size();i++)
             //sele_list[resi_list[pos].second[i]]=true;
     }
-    vector<bool>().swap(sele_list);
-    vector<pair<double,string> >().swap(linker_list);
+    //vector<bool>().swap(sele_list);
     //vector<pair<double,vector<long int> > >().swap(resi_list);
-    fp_out.close();
-    line.clear();
     return;
 }
 
+/* segments of the whole structure, numbered from 1, as in (1-50,91-120) */
+string segmentTxt(const vector<pair<long int,long int> > &segment_list)
+{
+    stringstream ss;
+    ss<<'(';
+    for (size_t s=0;s<segment_list.size();s++) ss<<(s?",":"")
+        <<segment_list[s].first+1<<'-'<<segment_list[s].second;
+    ss<<')';
+    return ss.str();
+}
+
+/* the part of a domain that is in range [start,end) of the domain */
+void sliceSegments(const vector<pair<long int,long int> > &segment_list,
+    const long int start, const long int end,
+    vector<pair<long int,long int> > &slice_list)
+{
+    long int offset=0, first, last;
+    for (size_t s=0;s<segment_list.size();s++)
+    {
+        const long int size=segment_list[s].second-segment_list[s].first;
+        first=max(start,offset);
+        last =min(end,offset+size);
+        offset+=size;
+        if (first>=last) continue;
+        first+=segment_list[s].first-(offset-size);
+        last +=segment_list[s].first-(offset-size);
+        if (slice_list.size() && slice_list.back().second==first)
+            slice_list.back().second=last;
+        else slice_list.push_back(make_pair(first,last));
+    }
+}
+
+/* split a domain, made of ranges segment_list of the whole structure and
+ * counted by bp_count, at its best boundary if the FU score is below 1,
+ * and then split both domains in the same way. The count tables of the
+ * two domains are sliced from those of this domain */
+void splitDomain(const BasePairCount &bp_count,
+    const vector<pair<long int,long int> > &segment_list, const int depth,
+    const char mode, const int threads, string &txt)
+{
+    vector<Linker> linker_list;
+    FUpred(bp_count,mode,threads,linker_list);
+    if (linker_list.size()==0 || linker_list[0].score>=1) return;
+    const long int L=bp_count.L;
+    const long int mid1=linker_list[0].mid1;
+    const long int mid2=linker_list[0].mid2;
+    const double score=linker_list[0].score;
+    vector<Linker>().swap(linker_list);
+
+    /* domain 1 and 2, numbered along this domain and along the structure */
+    vector<vector<pair<long int,long int> > > local_list(2), global_list(2);
+    local_list[0].push_back(make_pair(0L,mid1));
+    if (mid2<L) local_list[0].push_back(make_pair(mid2,L));
+    local_list[1].push_back(make_pair(mid1,mid2));
+    size_t d,s;
+    for (d=0;d<2;d++) for (s=0;s<local_list[d].size();s++)
+        sliceSegments(segment_list,local_list[d][s].first,
+            local_list[d][s].second,global_list[d]);
+
+    stringstream ss;
+    ss<<depth<<'\t'<<setiosflags(ios::fixed)<<setprecision(6)<<score
+      <<'\t'<<(mid2<L?'D':'C')<<'\t'<<segmentTxt(segment_list)<<'\t'
+      <<segmentTxt(global_list[0])<<segmentTxt(global_list[1])<<'\n';
+    txt+=ss.str();
+    for (d=0;d<2;d++)
+    {
+        BasePairCount domain_count(bp_count,local_list[d]);
+        splitDomain(domain_count,global_list[d],depth+1,mode,threads,txt);
+    }
+}
+
+/* output of one structure: seq.FU, or the domain hierarchy if recursive */
+void FUtxt(const Structure &ct, const char mode, const int threads,
+    const bool recursive, string &txt)
+{
+    BasePairCount bp_count(ct.L,ct.resi1_vec,ct.resi2_vec);
+    if (!recursive)
+    {
+        vector<Linker> linker_list;
+        FUpred(bp_count,mode,threads,linker_list);
+        writeFU(linker_list,txt);
+        return;
+    }
+    txt="#depth\tFUscore\tDC\t(domain)\t(domain1)(domain2)\n";
+    vector<pair<long int,long int> > segment_list(1,make_pair(0L,ct.L));
+    splitDomain(bp_count,segment_list,1,mode,threads,txt);
+}
+
+/* FU scores of each structure in infile. With a list, infile has one CT
+ * file per line, optionally followed by its own output file. Without
+ * one, the output of a structure goes to outfile after a line ">name".
+ * Structures of a list or of a multi structure file are predicted in
+ * parallel and written in input order; a single structure uses all
+ * threads to fill its FU score matrix */
+void rFUpred(const string infile="-", const string outfile="-",
+    const char mode='d', const char batch=0, int threads=1,
+    const bool recursive=false)
+{
+    ofstream fp_out;
+    if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
+    ostream &out=(outfile=="-")?cout:fp_out;
+    if (threads<1) threads=1;
+    string txt;
+    Structure ct;
+    if (batch==0)
+    {
+        CTReader fp_in(infile);
+        fp_in.next(ct);
+        FUtxt(ct,mode,threads,recursive,txt);
+        out<<txt;
+        fp_out.close();
+        return;
+    }
+
+    vector<string> ct_list, FU_list;
+    if (batch=='l')
+    {
+        ifstream fp_list;
+        if (infile!="-") fp_list.open(infile.c_str(),ios::in);
+        istream &in=(infile=="-")?cin:fp_list;
+        string line;
+        vector<string> line_vec;
+        while (getline(in,line))
+        {
+            line_vec.clear();
+            split(line,line_vec);
+            if (line_vec.size()==0 || line_vec[0][0]=='#') continue;
+            ct_list.push_back(line_vec[0]);
+            FU_list.push_back(line_vec.size()>1?line_vec[1]:"");
+        }
+        fp_list.close();
+    }
+    CTReader *fp_in=(batch=='m')?new CTReader(infile,true):NULL;
+
+    /* structures are read and predicted in batches of 16 per thread */
+    size_t Nbatch=16*threads;
+    size_t Nct=0;
+    bool more=true;
+    while (more)
+    {
+        vector<Structure> ct_batch;
+        vector<string> name_list, txt_list;
+        for (;ct_batch.size()<Nbatch;Nct++)
+        {
+            if (fp_in)
+            {
+                if (!(more=fp_in->next(ct))) break;
+                name_list.push_back(ct.name.size()?ct.name:
+                    "structure"+to_string(Nct+1));
+            }
+            else
+            {
+                if (!(more=(Nct<ct_list.size()))) break;
+                CTReader fp_ct(ct_list[Nct]);
+                fp_ct.next(ct);
+                name_list.push_back(ct_list[Nct]);
+            }
+            ct_batch.push_back(ct);
+        }
+        txt_list.resize(ct_batch.size());
+        atomic<size_t> next(0);
+        auto worker=[&]()
+        {
+            size_t c;
+            while ((c=next.fetch_add(1))<ct_batch.size())
+                FUtxt(ct_batch[c],mode,1,recursive,txt_list[c]);
+        };
+        vector<thread> thread_list;
+        for (int t=1;t<threads && t<(int)ct_batch.size();t++)
+            thread_list.push_back(thread(worker));
+        worker();
+        for (size_t t=0;t<thread_list.size();t++) thread_list[t].join();
+
+        for (size_t c=0;c<ct_batch.size();c++)
+        {
+            size_t n=Nct-ct_batch.size()+c;
+            if (!fp_in && FU_list[n].size())
+            {
+                ofstream fp_FU(FU_list[n].c_str(),ofstream::out);
+                fp_FU<<txt_list[c];
+                fp_FU.close();
+            }
+            else out<<'>'<<name_list[c]<<'\n'<<txt_list[c];
+        }
+    }
+    if (fp_in) delete fp_in;
+    fp_out.close();
+}
+
 int main(int argc, char **argv)
 {
     /* parse commad line argument */
-    if(argc<2)
+    char mode='d';
+    char batch=0;
+    int threads=1;
+    bool recursive=false;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if      (arg=="-float") mode='f';
+        else if (arg=="-band")  mode='b';
+        else if (arg=="-list")  batch='l';
+        else if (arg=="-multi") batch='m';
+        else if (arg=="-recursive") recursive=true;
+        else if (arg.substr(0,9)=="-threads=")
+            threads=atoi(arg.substr(9).c_str());
+        else arg_list.push_back(arg);
+    }
+    if (arg_list.size()<1)
     {
         cerr<<docstring;
         return 0;
     }
-    string infile=argv[1];
-    string outfile=(argc<=2)?"-":argv[2];
-    rFUpred(infile,outfile);
+    string infile=arg_list[0];
+    string outfile=(arg_list.size()<=1)?"-":arg_list[1];
+    rFUpred(infile,outfile,mode,batch,threads,recursive);
     return 0;
 }
@@ -0,0 +1,345 @@
+/* seqIO.h - block input and output of FASTA, A3M and PFAM text, shared
+ * by the format converters. Regular files are memory mapped, stdin and
+ * pipes are read in 4MB blocks, and output is collected in 4MB blocks
+ * that are written without a flush per line. Sequences are compared by
+ * a 128-bit hash instead of being kept. */
+#ifndef SEQIO_H
+#define SEQIO_H
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/* characters data[0..size-1] of a line or record. A span points into
+ * the input and is only valid until the reader moves on, unless the
+ * input is memory mapped */
+struct TextSpan
+{
+    const char *data;
+    size_t size;
+    TextSpan(): data(NULL), size(0) {}
+    TextSpan(const char *d, const size_t s): data(d), size(s) {}
+    char operator[](const size_t i) const {return data[i];}
+    string str() const {return string(data,size);}
+};
+
+/* lines of a file or of stdin ("-"), without the line break */
+class LineReader
+{
+public:
+    LineReader(const string &infile)
+    {
+        fd=0;
+        map=NULL;
+        map_size=0;
+        buf=NULL;
+        buf_size=begin=end=scan=0;
+        eof=false;
+        if (infile!="-" && (fd=open(infile.c_str(),O_RDONLY))<0)
+        {
+            cerr<<"ERROR! Cannot read "<<infile<<endl;
+            exit(1);
+        }
+        struct stat st;
+        if (fd && fstat(fd,&st)==0 && S_ISREG(st.st_mode) && st.st_size)
+        {
+            map_size=st.st_size;
+            map=(char *)mmap(NULL,map_size,PROT_READ,MAP_PRIVATE,fd,0);
+            if (map==MAP_FAILED) map=NULL;
+            else
+            {
+                madvise(map,map_size,MADV_SEQUENTIAL);
+                pos=released=map;
+                close(fd);
+                fd=-1;
+                return;
+            }
+        }
+        buf_size=4<<20;
+        buf=(char *)malloc(buf_size);
+    }
+
+    ~LineReader()
+    {
+        if (map) munmap(map,map_size);
+        if (buf) free(buf);
+        if (fd>0) close(fd);
+    }
+
+    /* spans stay valid for the lifetime of the reader */
+    bool mapped() const {return map!=NULL;}
+
+    /* next line, or false at the end of input */
+    bool next(TextSpan &line)
+    {
+        if (map)
+        {
+            const char *last=map+map_size;
+            if (pos>=last) return false;
+            const char *nl=(const char *)memchr(pos,'\n',last-pos);
+            if (!nl) nl=last;
+            line=TextSpan(pos,nl-pos);
+            pos=nl+1;
+            /* drop pages read more than 16MB ago from memory. They are
+             * read back from the file if a span still points there */
+            if (pos-released>=(2<<24))
+            {
+                madvise(released,1<<24,MADV_DONTNEED);
+                released+=1<<24;
+            }
+            return true;
+        }
+        while (true)
+        {
+            char *nl=(char *)memchr(buf+scan,'\n',end-scan);
+            if (nl)
+            {
+                line=TextSpan(buf+begin,nl-buf-begin);
+                begin=scan=nl-buf+1;
+                return true;
+            }
+            scan=end;
+            if (eof)
+            {
+                if (begin==end) return false;
+                line=TextSpan(buf+begin,end-begin);
+                begin=end;
+                return true;
+            }
+            /* keep the unfinished line and read the next block */
+            if (begin)
+            {
+                memmove(buf,buf+begin,end-begin);
+                end-=begin;
+                scan-=begin;
+                begin=0;
+            }
+            if (end==buf_size)
+            {
+                buf_size*=2;
+                buf=(char *)realloc(buf,buf_size);
+            }
+            ssize_t Nread=read(fd,buf+end,buf_size-end);
+            if (Nread<0 && errno==EINTR) continue;
+            if (Nread<=0) eof=true;
+            else end+=Nread;
+        }
+    }
+
+private:
+    int fd;
+    char *map;
+    size_t map_size;
+    const char *pos;   // next line in map
+    char *released;    // map before released is dropped from memory
+    char *buf;
+    size_t buf_size;
+    size_t begin;      // next line in buf
+    size_t end;        // end of data in buf
+    size_t scan;       // buf[begin..scan-1] has no line break
+    bool eof;
+};
+
+/* records of a FASTA or A3M file. Empty lines are skipped */
+class FastaReader
+{
+public:
+    FastaReader(const string &infile): reader(infile), pending(false) {}
+
+    /* next record. header is the whole header line including '>', and
+     * is empty for sequence lines before the first header. A sequence
+     * on one line of a mapped file is returned in place; the lines of a
+     * wrapped sequence are joined in a buffer reused for every record */
+    bool next(TextSpan &header, TextSpan &sequence)
+    {
+        header=sequence=TextSpan();
+        if (!pending && !nextLine()) return false;
+        pending=false;
+        if (line[0]=='>')
+        {
+            header=keep(line,header_buf);
+            if (!nextLine()) return true;
+            if (line[0]=='>')
+            {
+                pending=true;
+                return true;
+            }
+        }
+        bool joined=!reader.mapped();
+        if (joined) sequence_buf.assign(line.data,line.size);
+        else sequence=line;
+        while (nextLine())
+        {
+            if (line[0]=='>')
+            {
+                pending=true;
+                break;
+            }
+            if (!joined) sequence_buf.assign(sequence.data,sequence.size);
+            joined=true;
+            sequence_buf.append(line.data,line.size);
+        }
+        if (joined) sequence=TextSpan(sequence_buf.data(),sequence_buf.size());
+        return true;
+    }
+
+private:
+    LineReader reader;
+    TextSpan line;
+    bool pending;      // line is the header of the next record
+    string header_buf;
+    string sequence_buf;
+
+    bool nextLine()
+    {
+        while (reader.next(line)) if (line.size) return true;
+        return false;
+    }
+
+    /* copy span into buf unless the input is mapped */
+    TextSpan keep(const TextSpan &span, string &buf)
+    {
+        if (reader.mapped()) return span;
+        buf.assign(span.data,span.size);
+        return TextSpan(buf.data(),buf.size());
+    }
+};
+
+/* output to a file or to stdout ("-") through a 4MB buffer */
+class BlockWriter
+{
+public:
+    BlockWriter(const string &outfile)
+    {
+        fd=1;
+        if (outfile!="-" && (fd=open(outfile.c_str(),
+            O_WRONLY|O_CREAT|O_TRUNC,0666))<0)
+        {
+            cerr<<"ERROR! Cannot write "<<outfile<<endl;
+            exit(1);
+        }
+        buf_size=4<<20;
+        buf=(char *)malloc(buf_size);
+        end=0;
+    }
+
+    ~BlockWriter()
+    {
+        close();
+    }
+
+    void write(const char *data, size_t size)
+    {
+        if (end+size>buf_size)
+        {
+            flush();
+            if (size>=buf_size)
+            {
+                writeAll(data,size);
+                return;
+            }
+        }
+        memcpy(buf+end,data,size);
+        end+=size;
+    }
+    void write(const TextSpan &text) {write(text.data,text.size);}
+    void write(const string &text)   {write(text.data(),text.size());}
+    void put(const char c)
+    {
+        if (end==buf_size) flush();
+        buf[end++]=c;
+    }
+
+    /* write out the buffer and close the file */
+    void close()
+    {
+        if (!buf) return;
+        flush();
+        free(buf);
+        buf=NULL;
+        if (fd>1) ::close(fd);
+    }
+
+private:
+    int fd;
+    char *buf;
+    size_t buf_size;
+    size_t end;
+
+    void flush()
+    {
+        writeAll(buf,end);
+        end=0;
+    }
+
+    void writeAll(const char *data, size_t size)
+    {
+        while (size)
+        {
+            ssize_t Nwrite=::write(fd,data,size);
+            if (Nwrite<0 && errno==EINTR) continue;
+            if (Nwrite<=0)
+            {
+                cerr<<"ERROR! Cannot write output"<<endl;
+                exit(1);
+            }
+            data+=Nwrite;
+            size-=Nwrite;
+        }
+    }
+};
+
+/* 128-bit hash of a sequence, kept instead of the sequence itself */
+struct SeqHash
+{
+    uint64_t h1,h2;
+    bool operator==(const SeqHash &other) const
+    {
+        return h1==other.h1 && h2==other.h2;
+    }
+};
+
+struct SeqHashHasher
+{
+    size_t operator()(const SeqHash &hash) const {return hash.h1;}
+};
+
+inline uint64_t mix64(uint64_t x)
+{
+    x^=x>>33;
+    x*=0xff51afd7ed558ccdULL;
+    x^=x>>33;
+    x*=0xc4ceb9fe1a85ec53ULL;
+    x^=x>>33;
+    return x;
+}
+
+/* two independent hashes of data[0..size-1], eight bytes at a time */
+inline SeqHash hashSeq(const char *data, const size_t size)
+{
+    SeqHash hash={0x9e3779b97f4a7c15ULL^size, 0x632be59bd9b4e019ULL+size};
+    uint64_t word;
+    size_t i;
+    for (i=0;i+8<=size;i+=8)
+    {
+        memcpy(&word,data+i,8);
+        hash.h1=mix64(hash.h1^word);
+        hash.h2=mix64(hash.h2+word*0x9fb21c651e98df25ULL);
+    }
+    word=0;
+    memcpy(&word,data+i,size-i);
+    hash.h1=mix64(hash.h1^word);
+    hash.h2=mix64(hash.h2+word*0x9fb21c651e98df25ULL);
+    return hash;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#!/bin/bash
+# s8 shares no words with the query or any representative. s5 is 0.9
+# identical to s7 and must still be compared to it with its own short
+# word profile rather than that left over from s8, as cd-hit-est does
+#     cd-hit-est-2d -i seq.fasta -i2 trim.db -c 0.90 -o db.2d -l 40
+#     cd-hit-est -i db.2d -c 0.90 -o db.0.90 -l 40
+bindir=`dirname $0`/..
+tmpdir=`mktemp -d`
+trap "rm -rf $tmpdir" EXIT
+
+cat > $tmpdir/seq.fasta << EOF
+>q
+CGATTCAAATGACGGCAGCAGGCCGGGAGTCCCTGAGAGGCTTGTTCCGGAAATGTGCCATCTGCGTGCGAACGCAGCGTAAGAGGAGGGCTAGCTGCGT
+EOF
+cat > $tmpdir/trim.db << EOF
+>s5
+GATATTATCCGGTGTCGGTTAGGATCGACTTTTCACCAGATTCAC
+>s7
+CGAGATATTATCCAGTGTCGGTTAGCATCGACTTTTCACCAGATTCAC
+>s8
+GCGTTTCGGGCTACCGCCGAATCGGGCGAAAGCCCTAACACGTCTC
+>s11
+GCGAGATATTATCCAGTGTCGGTGAGCATCGACTTTTCACCAGATACACCG
+EOF
+
+$bindir/clusterNA $tmpdir/seq.fasta $tmpdir/trim.db $tmpdir/db 0.90 > /dev/null
+rep=`grep '>' $tmpdir/db.0.90 | tr -d '>' | tr '\n' ' '`
+if [ "$rep" != "s8 s11 " ];then
+    echo "FAIL clusterNA: representatives $rep, expected s8 s11"
+    exit 1
+fi
+echo "PASS clusterNA"
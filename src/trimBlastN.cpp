@@ -6,6 +6,24 @@ const char* docstring=""
 "    blastnt.tab must be generated by\n"
 "    $ blastn -outfmt '6 saccver sstart send'\n"
 "    the output sequence order followes blastnt.tab rather than blastnt.db\n"
+"\n"
+"trimBlastN -blastdb nt blastnt.tab L > blastnt.trim.fasta\n"
+"    read the fragments directly from the volumes of BLAST nucleotide\n"
+"    database nt (a .nal alias or a single volume), which must be made by\n"
+"    $ makeblastdb -dbtype nucl -parse_seqids -blastdb_version 4\n"
+"    so that accessions can be looked up in the .nsd index of each volume\n"
+"\n"
+"Options:\n"
+"    -uniq        only output the first fragment, in the order of\n"
+"                 blastnt.tab, of each distinct sequence\n"
+"    -threads=1   number of threads. blastnt.db may be a comma separated\n"
+"                 list of fasta files, which are read in parallel\n"
+"    -max=0       only use the best N lines of blastnt.tab, by e-value in\n"
+"                 the 4th column, as 'sort -k4g | head -N' would.\n"
+"                 0 means all lines in input order\n"
+"    -merge       merge hits to the same strand of the same sequence whose\n"
+"                 flanked regions overlap into one fragment, which takes\n"
+"                 the place of the best of them\n"
 ;
 
 #include <iostream>
@@ -14,8 +32,20 @@ const char* docstring=""
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cmath>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <queue>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "seqIO.h"
 
 using namespace std;
 
@@ -99,106 +129,563 @@ void reverse_complement(const string &watson, string &crick)
     return;
 }
 
-void getSeqTxt(const vector<string>&acc_list, const vector<size_t>&from_list,
-    const vector<size_t>&to_list, const int L, const string &header,
-    const string &sequence, vector<pair<size_t,string> > &seq_pair)
+/* hits of each accession, as line numbers in the tab file */
+typedef unordered_map<string,vector<size_t> > HitMap;
+
+/* 1-based flanked interval from..to of a hit from sstart to send, and
+ * whether the hit is on the forward (f) or reverse (r) strand */
+void flankHit(const size_t sstart, const size_t send, const int L,
+    size_t &from, size_t &to, char &fr)
+{
+    if (sstart<send)
+    {
+        from=sstart;
+        to  =send;
+        fr  ='f';
+    }
+    else
+    {
+        from=send;
+        to  =sstart;
+        fr  ='r';
+    }
+    if (from<(size_t)L+1) from=1;
+    else from-=L;
+    to  +=L;
+}
+
+/* fasta record of a fragment, given as read from the forward strand */
+string fragmentTxt(const string &header, const size_t from, const size_t to,
+    const char fr, const string &watson)
 {
-    size_t n,from,to;
     stringstream ss;
+    string fragment=watson;
+    if (fr=='r') reverse_complement(watson,fragment);
+    ss<<'>'<<header<<'_'<<from<<'_'<<to<<'_'<<fr<<'\n'<<fragment<<'\n';
+    return ss.str();
+}
+
+/* flanked region of a hit to the record being read, and the bases of
+ * the region that have been read so far */
+struct HitWindow
+{
+    size_t from,to,n;
     char fr;
-    string fragment;
-    for (n=0;n<acc_list.size();n++)
+    string watson;
+    bool operator<(const HitWindow &other) const
+    {
+        return from<other.from;
+    }
+};
+
+/* windows of the hits to record header, sorted by start */
+void openWindows(const HitMap &hit_map, const vector<size_t>&from_list,
+    const vector<size_t>&to_list, const int L, const string &header,
+    vector<HitWindow> &window_list)
+{
+    window_list.clear();
+    HitMap::const_iterator it=hit_map.find(header);
+    if (it==hit_map.end()) return;
+    const vector<size_t> &hit_list=it->second;
+    HitWindow window;
+    for (size_t h=0;h<hit_list.size();h++)
+    {
+        window.n=hit_list[h];
+        flankHit(from_list[window.n],to_list[window.n],L,
+            window.from,window.to,window.fr);
+        window_list.push_back(window);
+    }
+    stable_sort(window_list.begin(),window_list.end());
+}
+
+/* append bases pos+1..pos+line.size() of the record to the windows that
+ * overlap them. Windows from next on have not started yet; a window is
+ * written out as soon as its last base has been read */
+void fillWindows(const string &header, const string &line, const size_t pos,
+    vector<HitWindow> &window_list, size_t &next, vector<size_t> &active_list,
+    vector<pair<size_t,string> > &seq_pair)
+{
+    size_t end=pos+line.size();
+    while (next<window_list.size() && window_list[next].from<=end)
+        active_list.push_back(next++);
+    size_t a,b;
+    for (a=b=0;a<active_list.size();a++)
+    {
+        HitWindow &window=window_list[active_list[a]];
+        size_t first=max(pos+1,window.from);
+        size_t last =min(end,window.to);
+        if (first<=last) window.watson.append(line,first-1-pos,last-first+1);
+        if (window.to<=end)
+        {
+            seq_pair.push_back(make_pair(window.n,fragmentTxt(header,
+                window.from,window.to,window.fr,window.watson)));
+            string().swap(window.watson);
+        }
+        else active_list[b++]=active_list[a];
+    }
+    active_list.resize(b);
+}
+
+/* write out windows that run past the end of the record, clipped to it */
+void closeWindows(const string &header, vector<HitWindow> &window_list,
+    vector<size_t> &active_list, vector<pair<size_t,string> > &seq_pair)
+{
+    for (size_t a=0;a<active_list.size();a++)
+    {
+        HitWindow &window=window_list[active_list[a]];
+        seq_pair.push_back(make_pair(window.n,fragmentTxt(header,
+            window.from,window.to,window.fr,window.watson)));
+    }
+    active_list.clear();
+    window_list.clear();
+}
+
+/* one volume of a BLAST nucleotide database of format version 4 */
+struct BlastVolume
+{
+    string name;
+    char *nin, *nsq, *nsd;
+    size_t nin_size, nsq_size, nsd_size;
+    uint32_t Noid;
+    size_t seq_off; // offset of the sequence offset array in .nin
+    size_t amb_off; // offset of the ambiguity offset array in .nin
+};
+
+/* memory map a whole file for random access. return NULL on failure */
+char *mapBlastFile(const string &filename, size_t &size)
+{
+    int fd=open(filename.c_str(),O_RDONLY);
+    if (fd<0) return NULL;
+    struct stat st;
+    if (fstat(fd,&st) || st.st_size==0)
+    {
+        close(fd);
+        return NULL;
+    }
+    size=st.st_size;
+    char *buf=(char *)mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (buf==MAP_FAILED) return NULL;
+    madvise(buf,size,MADV_RANDOM);
+    return buf;
+}
+
+/* BLAST databases store integers in big endian */
+inline uint32_t be32(const char *p)
+{
+    const unsigned char *u=(const unsigned char *)p;
+    return ((uint32_t)u[0]<<24)|((uint32_t)u[1]<<16)|
+           ((uint32_t)u[2]<<8)|(uint32_t)u[3];
+}
+
+/* open the volumes of BLAST database dbname. An alias file dbname.nal
+ * lists its volumes, relative to its own folder, after DBLIST */
+void openBlastDB(const string &dbname, vector<BlastVolume> &vol_list)
+{
+    ifstream fp((dbname+".nal").c_str(),ios::in);
+    if (fp.is_open())
+    {
+        string dirname;
+        if (dbname.find('/')!=string::npos)
+            dirname=dbname.substr(0,dbname.find_last_of('/')+1);
+        string line,volname;
+        while (getline(fp,line))
+        {
+            if (line.substr(0,7)!="DBLIST ") continue;
+            stringstream ss(line.substr(7));
+            while (ss>>volname)
+            {
+                if (volname.size()>1 && volname[0]=='"')
+                    volname=volname.substr(1,volname.size()-2);
+                if (volname[0]!='/') volname=dirname+volname;
+                openBlastDB(volname,vol_list);
+            }
+        }
+        fp.close();
+        return;
+    }
+
+    BlastVolume vol;
+    vol.name=dbname;
+    vol.nin=mapBlastFile(dbname+".nin",vol.nin_size);
+    vol.nsq=mapBlastFile(dbname+".nsq",vol.nsq_size);
+    vol.nsd=mapBlastFile(dbname+".nsd",vol.nsd_size);
+    if (!vol.nin || !vol.nsq || !vol.nsd)
+    {
+        cerr<<"ERROR! Cannot map "<<dbname<<".nin, .nsq and .nsd"<<endl;
+        exit(1);
+    }
+    /* version, type (0 for nucleotide), title, date, number of
+     * sequences, total length (8 bytes), maximum length, then the
+     * header, sequence and ambiguity offset arrays of Noid+1 entries */
+    size_t p=0;
+    if (be32(vol.nin)!=4 || be32(vol.nin+4)!=0)
+    {
+        cerr<<"ERROR! "<<dbname<<" is not a version 4 nucleotide database"
+            <<endl;
+        exit(1);
+    }
+    p=8;
+    p+=4+be32(vol.nin+p); // title
+    p+=4+be32(vol.nin+p); // date
+    vol.Noid=be32(vol.nin+p);
+    p+=4+8+4;
+    vol.seq_off=p+4*((size_t)vol.Noid+1);
+    vol.amb_off=vol.seq_off+4*((size_t)vol.Noid+1);
+    if (vol.amb_off+4*((size_t)vol.Noid+1)>vol.nin_size)
+    {
+        cerr<<"ERROR! "<<dbname<<".nin is truncated"<<endl;
+        exit(1);
+    }
+    vol_list.push_back(vol);
+}
+
+/* compare the key of the .nsd line at line, terminated by byte 2, with
+ * lower case accession acc */
+int compareKey(const char *line, const char *last, const string &acc)
+{
+    size_t i;
+    for (i=0;line+i<last && line[i]!=2 && line[i]!='\n';i++)
+    {
+        if (i==acc.size()) return 1;
+        unsigned char a=tolower(line[i]);
+        unsigned char b=acc[i];
+        if (a!=b) return (a<b)?-1:1;
+    }
+    return (i<acc.size())?-1:0;
+}
+
+/* ordinal id of lower case accession acc in a volume, or -1. The .nsd
+ * file is sorted lines of "key\2oid\n", which are binary searched */
+long lookupOid(const BlastVolume &vol, const string &acc)
+{
+    const char *buf=vol.nsd;
+    const char *last=buf+vol.nsd_size;
+    size_t lo=0, hi=vol.nsd_size;
+    while (lo<hi)
     {
-        if (acc_list[n]!=header) continue;
-        if (from_list[n]<to_list[n])
+        size_t mid=lo+(hi-lo)/2;
+        size_t line=mid;
+        while (line>lo && buf[line-1]!='\n') line--;
+        if (compareKey(buf+line,last,acc)<0)
         {
-            from=from_list[n];
-            to  =to_list[n];
-            fr  ='f';
+            const char *end=(const char *)memchr(buf+mid,'\n',last-buf-mid);
+            lo=end?end-buf+1:vol.nsd_size;
+        }
+        else hi=line;
+    }
+    if (lo>=vol.nsd_size || compareKey(buf+lo,last,acc)) return -1;
+    const char *oid=(const char *)memchr(buf+lo,2,last-buf-lo);
+    return oid?atol(oid+1):-1;
+}
+
+/* bases from..to (1-based, clipped to the sequence) of sequence oid.
+ * Bases are packed four per byte from the high bits; the last byte
+ * holds the number of bases in it in its lowest two bits. Runs of
+ * ambiguous bases follow the sequence and overwrite packed bases. */
+void fetchBases(const BlastVolume &vol, const uint32_t oid, size_t from,
+    size_t to, string &watson)
+{
+    static const char na2[]="ACGT";
+    static const char na4[]="-ACMGRSVTWYHKDBN";
+    const unsigned char *nsq=(const unsigned char *)vol.nsq;
+    size_t seq_begin=be32(vol.nin+vol.seq_off+4*(size_t)oid);
+    size_t amb_begin=be32(vol.nin+vol.amb_off+4*(size_t)oid);
+    size_t amb_end  =be32(vol.nin+vol.seq_off+4*((size_t)oid+1));
+    size_t Lseq=4*(amb_begin-seq_begin-1)+(nsq[amb_begin-1]&3);
+    watson.clear();
+    if (to>Lseq) to=Lseq;
+    if (from>to) return;
+    watson.resize(to-from+1);
+    size_t i;
+    for (i=from-1;i<to;i++) watson[i-from+1]=
+        na2[(nsq[seq_begin+i/4]>>(6-2*(i%4)))&3];
+    if (amb_end<=amb_begin) return;
+
+    /* first word is the number of entries, or with the highest bit set,
+     * the number of words in two-word entries for long runs */
+    const char *amb=vol.nsq+amb_begin;
+    uint32_t Namb=be32(amb);
+    bool long_run=(Namb>>31);
+    Namb&=0x7fffffff;
+    for (uint32_t a=1;a<=Namb;a+=1+long_run)
+    {
+        uint32_t word=be32(amb+4*a);
+        size_t pos,len;
+        if (long_run)
+        {
+            len=((word>>16)&0xfff)+1;
+            pos=be32(amb+4*(a+1));
         }
         else
         {
-            from=to_list[n];
-            to  =from_list[n];
-            fr  ='r';
-        }
-        if (from<L+1) from=1;
-        else from-=L;
-        to  +=L;
-        fragment=sequence.substr(from-1,to-from+1);
-        if (fr=='r') reverse_complement(
-                 sequence.substr(from-1,to-from+1),fragment);
-        ss<<'>'<<header<<'_'<<from<<'_'<<to<<'_'<<fr<<'\n'
-            <<fragment<<'\n';
-        seq_pair.push_back(make_pair(n,ss.str()));
-        ss.str(string());
-        fragment.clear();
+            len=((word>>24)&0xf)+1;
+            pos=word&0xffffff;
+        }
+        for (i=max(pos,from-1);i<min(pos+len,to);i++)
+            watson[i-from+1]=na4[word>>28];
+    }
+}
+
+/* fragments of all hits read from the volumes of BLAST database dbname.
+ * Each accession is looked up once, in the first volume that has it */
+void getBlastSeqTxt(const HitMap &hit_map, const vector<size_t>&from_list,
+    const vector<size_t>&to_list, const int L, const string &dbname,
+    vector<pair<size_t,string> > &seq_pair)
+{
+    vector<BlastVolume> vol_list;
+    openBlastDB(dbname,vol_list);
+    size_t h,n,v,from,to;
+    char fr;
+    string acc,watson;
+    long oid;
+    for (HitMap::const_iterator it=hit_map.begin();it!=hit_map.end();it++)
+    {
+        acc=it->first;
+        for (h=0;h<acc.size();h++) acc[h]=tolower(acc[h]);
+        for (v=0,oid=-1;v<vol_list.size();v++)
+            if ((oid=lookupOid(vol_list[v],acc))>=0) break;
+        if (oid<0 || oid>=vol_list[v].Noid) continue;
+        const vector<size_t> &hit_list=it->second;
+        for (h=0;h<hit_list.size();h++)
+        {
+            n=hit_list[h];
+            flankHit(from_list[n],to_list[n],L,from,to,fr);
+            fetchBases(vol_list[v],oid,from,to,watson);
+            if (watson.size()) seq_pair.push_back(make_pair(n,
+                fragmentTxt(it->first,from,to,fr,watson)));
+        }
+    }
+    for (v=0;v<vol_list.size();v++)
+    {
+        munmap(vol_list[v].nin,vol_list[v].nin_size);
+        munmap(vol_list[v].nsq,vol_list[v].nsq_size);
+        munmap(vol_list[v].nsd,vol_list[v].nsd_size);
     }
     return;
 }
 
-void trimBlastN(const string indbfile="-", const string intabfile="-",
-    const int L=0, const string outfile="-")
+/* fragments of all hits in fasta file indbfile */
+void readDbTxt(const string indbfile, const HitMap &hit_map,
+    const vector<size_t>&from_list, const vector<size_t>&to_list,
+    const int L, vector<pair<size_t,string> > &seq_pair)
 {
-    /* read tab file */
-    vector<string> acc_list;
-    vector<size_t> from_list;
-    vector<size_t> to_list;
-    string line;
+    ifstream fp_in;
+    if (indbfile!="-") fp_in.open(indbfile.c_str(),ios::in);
+    string line,header;
     vector<string>line_vec;
-    size_t i;
+    vector<HitWindow> window_list;
+    vector<size_t> active_list;
+    size_t i,pos=0,next=0;
+    while ((indbfile!="-")?fp_in.good():cin.good())
+    {
+        if (indbfile!="-") getline(fp_in,line);
+        else               getline(cin,line);
+
+        if (line.length()==0) continue;
+        if (line[0]=='>')
+        {
+            closeWindows(header,window_list,active_list,seq_pair);
+            split(line, line_vec, ' ');
+            header=line_vec[0].substr(1);
+            for (i=0;i<line_vec.size();i++) line_vec[i].clear();
+            line_vec.clear();
+            openWindows(hit_map,from_list,to_list,L,header,window_list);
+            pos=next=0;
+        }
+        else if (window_list.size())
+        {
+            fillWindows(header,line,pos,window_list,next,active_list,
+                seq_pair);
+            pos+=line.size();
+        }
+    }
+    fp_in.close();
+    closeWindows(header,window_list,active_list,seq_pair);
+    return;
+}
+
+/* a line of the tab file ranked by e-value, with ties broken by the
+ * whole line, as the last resort comparison of sort */
+struct RankedLine
+{
+    double evalue;
+    string line;
+    bool operator<(const RankedLine &other) const
+    {
+        if (evalue!=other.evalue) return evalue<other.evalue;
+        return line<other.line;
+    }
+};
+
+/* read non-empty lines of the tab file. If max_hits is not 0, keep the
+ * best max_hits lines in a bounded heap and return them from the best */
+void readTab(const string intabfile, const size_t max_hits,
+    vector<string> &tab_list)
+{
     ifstream fp_in;
     if (intabfile!="-") fp_in.open(intabfile.c_str(),ios::in);
+    priority_queue<RankedLine> heap;
+    RankedLine ranked;
+    string line;
+    size_t i,field;
     while ((intabfile!="-")?fp_in.good():cin.good())
     {
         if (intabfile!="-") getline(fp_in,line);
         else                getline(cin,line);
         if (line.size()==0) continue;
-        split(line,line_vec,'\t');
+        if (max_hits==0)
+        {
+            tab_list.push_back(line);
+            continue;
+        }
+        for (i=0,field=1;i<line.size() && field<4;i++)
+            field+=(line[i]=='\t');
+        ranked.evalue=(field==4)?strtod(line.c_str()+i,NULL):-HUGE_VAL;
+        ranked.line.swap(line);
+        if (heap.size()==max_hits && !(ranked<heap.top())) continue;
+        heap.push(ranked);
+        if (heap.size()>max_hits) heap.pop();
+    }
+    if (intabfile!="-") fp_in.close();
+    if (max_hits==0) return;
+    tab_list.resize(heap.size());
+    for (i=heap.size();i>0;i--)
+    {
+        tab_list[i-1]=heap.top().line;
+        heap.pop();
+    }
+    return;
+}
+
+/* merge hits of each accession to the same strand whose flanked regions
+ * overlap. The merged hit spans all of them and keeps the line number of
+ * the best one; the others are removed from hit_map */
+void mergeHits(HitMap &hit_map, vector<size_t>&from_list,
+    vector<size_t>&to_list, const int L)
+{
+    size_t h,n,from,to;
+    char fr;
+    vector<pair<pair<char,size_t>,pair<size_t,size_t> > > span_list;
+    for (HitMap::iterator it=hit_map.begin();it!=hit_map.end();it++)
+    {
+        vector<size_t> &hit_list=it->second;
+        if (hit_list.size()<2) continue;
+        span_list.clear();
+        for (h=0;h<hit_list.size();h++)
+        {
+            n=hit_list[h];
+            flankHit(from_list[n],to_list[n],L,from,to,fr);
+            span_list.push_back(make_pair(make_pair(fr,from),
+                make_pair(to,n)));
+        }
+        sort(span_list.begin(),span_list.end());
+        hit_list.clear();
+        for (h=0;h<span_list.size();h++)
+        {
+            fr  =span_list[h].first.first;
+            from=span_list[h].first.second;
+            to  =span_list[h].second.first;
+            n   =span_list[h].second.second;
+            size_t m=hit_list.size()?hit_list.back():0;
+            size_t last_to=hit_list.size()?max(from_list[m],to_list[m])+L:0;
+            bool last_fr=hit_list.size() && from_list[m]<to_list[m];
+            if (hit_list.size() && last_fr==(fr=='f') && from<=last_to)
+            {
+                /* widen hit m to cover hit n, unflanked */
+                size_t lo=min(min(from_list[m],to_list[m]),
+                              min(from_list[n],to_list[n]));
+                size_t hi=max(max(from_list[m],to_list[m]),
+                              max(from_list[n],to_list[n]));
+                if (n<m)
+                {
+                    hit_list.back()=n;
+                    m=n;
+                }
+                from_list[m]=(fr=='f')?lo:hi;
+                to_list[m]  =(fr=='f')?hi:lo;
+            }
+            else hit_list.push_back(n);
+        }
+        sort(hit_list.begin(),hit_list.end());
+    }
+    return;
+}
+
+void trimBlastN(const string indbfile="-", const string intabfile="-",
+    const int L=0, const string outfile="-", const bool blastdb=false,
+    const bool uniq=false, int threads=1, const size_t max_hits=0,
+    const bool merge=false)
+{
+    /* read tab file */
+    HitMap hit_map;
+    vector<size_t> from_list;
+    vector<size_t> to_list;
+    vector<string> tab_list;
+    vector<string>line_vec;
+    size_t i,t;
+    readTab(intabfile,max_hits,tab_list);
+    for (t=0;t<tab_list.size();t++)
+    {
+        split(tab_list[t],line_vec,'\t');
         if (line_vec.size()<=2)
         {
             cerr<<"FATAL ERROR! Less than 3 columns in "<<intabfile<<endl;
             return;
         }
-        acc_list.push_back(line_vec[0]);
-        from_list.push_back(atoi(line_vec[1].c_str()));
-        to_list.push_back(atoi(line_vec[2].c_str()));
+        hit_map[line_vec[0]].push_back(from_list.size());
+        from_list.push_back(strtoull(line_vec[1].c_str(),NULL,10));
+        to_list.push_back(strtoull(line_vec[2].c_str(),NULL,10));
         for (i=0;i<line_vec.size();i++) line_vec[i].clear();
         line_vec.clear();
     }
-    if (intabfile!="-") fp_in.close();
+    vector<string>().swap(tab_list);
+    if (merge) mergeHits(hit_map,from_list,to_list,L);
 
-    /* read db file */
-    if (indbfile!="-") fp_in.open(indbfile.c_str(),ios::in);
-    string sequence,header;
+    /* read db file. Comma separated fasta files are read in parallel */
     vector<pair<size_t,string> > seq_pair;
-    while ((indbfile!="-")?fp_in.good():cin.good())
+    if (blastdb) getBlastSeqTxt(hit_map,from_list,to_list,L,indbfile,seq_pair);
+    else
     {
-        if (indbfile!="-") getline(fp_in,line);
-        else               getline(cin,line);
-
-        if (line.length()==0) continue;
-        if (line[0]=='>')
+        vector<string> db_list;
+        split(indbfile,db_list,',');
+        vector<vector<pair<size_t,string> > > seq_pair_list(db_list.size());
+        atomic<size_t> next(0);
+        auto worker=[&]()
         {
-            if (sequence.length()>0) getSeqTxt(acc_list,
-                from_list, to_list, L, header, sequence, seq_pair);
-            sequence.clear();
-            split(line, line_vec, ' ');
-            header=line_vec[0].substr(1);
-            for (i=0;i<line_vec.size();i++) line_vec[i].clear();
-            line_vec.clear();
+            size_t d;
+            while ((d=next.fetch_add(1))<db_list.size()) readDbTxt(
+                db_list[d],hit_map,from_list,to_list,L,seq_pair_list[d]);
+        };
+        if (threads<1) threads=1;
+        vector<thread> thread_list;
+        for (int t=1;t<threads && t<(int)db_list.size();t++)
+            thread_list.push_back(thread(worker));
+        worker();
+        for (size_t t=0;t<thread_list.size();t++) thread_list[t].join();
+        for (size_t d=0;d<db_list.size();d++)
+        {
+            seq_pair.insert(seq_pair.end(),seq_pair_list[d].begin(),
+                seq_pair_list[d].end());
+            vector<pair<size_t,string> >().swap(seq_pair_list[d]);
         }
-        else sequence+=line;
     }
-    fp_in.close();
-    getSeqTxt(acc_list, from_list, to_list, L, header, sequence, seq_pair);
 
-    /* print out sequence */
+    /* print out sequence. With uniq, a fragment is skipped if an earlier
+     * line of the tab file gave the same sequence */
     sort (seq_pair.begin(), seq_pair.end()); 
+    unordered_set<SeqHash,SeqHashHasher> seen_set;
     ofstream fp_out;
     if (outfile!="-") fp_out.open(outfile.c_str(),ofstream::out);
     for (size_t n=0;n<seq_pair.size();n++)
     {
+        if (uniq)
+        {
+            const string &txt=seq_pair[n].second;
+            size_t nl=txt.find('\n');
+            if (!seen_set.insert(hashSeq(txt.data()+nl,
+                txt.size()-nl)).second) continue;
+        }
         if (outfile!="-") fp_out<<seq_pair[n].second;
         else                cout<<seq_pair[n].second;
     }
@@ -208,10 +695,8 @@ void trimBlastN(const string indbfile="-", const string intabfile="-",
     /* clean up */
     from_list.clear();
     to_list.clear();
-    vector<string>().swap(acc_list);
-    sequence.clear();
-    header.clear();
-    line.clear();
+    HitMap().swap(hit_map);
+    unordered_set<SeqHash,SeqHashHasher>().swap(seen_set);
     vector<pair<size_t,string> > ().swap(seq_pair);
     return;
 }
@@ -219,15 +704,40 @@ void trimBlastN(const string indbfile="-", const string intabfile="-",
 int main(int argc, char **argv)
 {
     /* parse commad line argument */
-    if(argc<3)
+    bool blastdb=false;
+    bool uniq=false;
+    int threads=1;
+    size_t max_hits=0;
+    bool merge=false;
+    vector<string> arg_list;
+    string arg;
+    for (int a=1;a<argc;a++)
+    {
+        arg=argv[a];
+        if      (arg=="-blastdb") blastdb=true;
+        else if (arg=="-uniq")    uniq=true;
+        else if (arg=="-merge")   merge=true;
+        else if (arg.substr(0,9)=="-threads=")
+            threads=atoi(arg.substr(9).c_str());
+        else if (arg.substr(0,5)=="-max=")
+            max_hits=strtoul(arg.substr(5).c_str(),NULL,10);
+        else if (arg.size()>1 && arg[0]=='-')
+        {
+            cerr<<"ERROR! Unknown option "<<arg<<endl;
+            return 1;
+        }
+        else arg_list.push_back(arg);
+    }
+    if(arg_list.size()<2)
     {
         cerr<<docstring;
         return 0;
     }
-    string indbfile =argv[1];
-    string intabfile=argv[2];
-    int    L        =(argc<=3)?0:atoi(argv[3]);
-    string outfile  =(argc<=4)?"-":argv[4];
-    trimBlastN(indbfile,intabfile,L,outfile);
+    string indbfile =arg_list[0];
+    string intabfile=arg_list[1];
+    int    L        =(arg_list.size()<=2)?0:atoi(arg_list[2].c_str());
+    string outfile  =(arg_list.size()<=3)?"-":arg_list[3];
+    trimBlastN(indbfile,intabfile,L,outfile,blastdb,uniq,threads,
+        max_hits,merge);
     return 0;
 }